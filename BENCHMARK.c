@@ -0,0 +1,391 @@
+/*
+  The benchmark file times the hot paths of the program one call at a time on the
+  cycle counter: decoding a recipe byte, one dispatch of the recipe interpreter,
+  running a command set and formatting a line of output.  Each case reports the
+  average cycles per call, taken from the quickest of a few batches of calls, the
+  calls per second that gives at the core clock and the worst single call, which is
+  where an interrupt landing in the middle shows up.
+
+  On the board the suite runs once at boot when the program is built with
+  BENCHMARK_AT_BOOT defined, and times on the DWT cycle counter.  servo_sim -B runs
+  the same cases on the host clock and compares them with a baseline timed on the
+  same machine.  servo_sim -B -l compares the board's timings, from a capture of its
+  console, with a baseline taken from an earlier capture.
+
+  The self test behind the Q command is the quick version for a board in the field:
+  console throughput, the interpreter, interrupt entry, deadline jitter and idle time
+  in one short report, with no debugger needed.  The M command runs every case once
+  more to see how much stack its call path takes
+*/
+
+#include "BENCHMARK.h"
+#include "HAL.h"
+#include "Helper.h"
+#include "DELAY.h"
+#include "TIMING_WHEEL.h"
+#include "POWER.h"
+#include "STACK.h"
+#include "RECIPE_TRACE.h"
+
+// The servos and recipes in main.c, and the parts of main.c the cases time
+extern INSTANCE servo_data motors[NUMBER_OF_SERVOS + SCRATCH_SLOTS];
+extern INSTANCE int recipes[NUMBER_OF_RECIPES + SCRATCH_SLOTS][MAX_RECIPE_SIZE];
+int recipe_step(int servo_index);
+int process_user_input(char commands[COMMAND_BUFFER_SIZE]);
+
+// Keeps the compiler from dropping calls whose result is not used
+static INSTANCE volatile uint32_t benchmark_sink;
+
+// Set by the self test's interrupt and timing wheel callback
+static INSTANCE volatile uint32_t self_test_entry_cycles;
+static INSTANCE volatile int self_test_interrupted;
+static INSTANCE volatile int self_test_deadline_passed;
+
+/*
+	Helper function that waits until the console has sent everything, so the output
+	of one call never has to wait on the output of the last one
+*/
+static void benchmark_console_idle(){
+	hal_serial_tx_flush();
+}
+
+static void benchmark_get_instruction(uint32_t iteration){
+	current_instruction instruction = get_instruction((uint8_t)iteration);
+
+	benchmark_sink += instruction.opcode + instruction.parameter;
+}
+
+/*
+	The recipe_step case puts the scratch servo at the END_LOOP of a scratch recipe
+	loop that never runs out, so every call is one full trip through the
+	interpreter's dispatch
+*/
+static void benchmark_recipe_step_setup(){
+	servo_data *motor = &motors[BENCHMARK_SERVO];
+
+	recipe_trace_enable(RECIPE_TRACE_OFF);
+	recipes[BENCHMARK_RECIPE][0] = LOOP;
+	recipes[BENCHMARK_RECIPE][1] = END_LOOP;
+
+	motor->recipe_index = BENCHMARK_RECIPE;
+	motor->shadow_recipe_index = NO_RECIPE;
+	motor->recipe_instruction_index = 1;
+	motor->recipe_loop_index = 1;
+	motor->recipe_loop_count = BENCHMARK_LOOP_COUNT;
+	motor->inside_recipe_loop = INSIDE_RECIPE_LOOP;
+	motor->recipe_status = idle;
+}
+
+static void benchmark_recipe_step(uint32_t iteration){
+	benchmark_sink += recipe_step(BENCHMARK_SERVO);
+}
+
+static void benchmark_recipe_step_teardown(){
+	recipe_trace_enable(RECIPE_TRACE_ON);
+}
+
+static void benchmark_process_user_input(uint32_t iteration){
+	char commands[COMMAND_BUFFER_SIZE + 1] = BENCHMARK_COMMAND_SET;
+
+	benchmark_sink += process_user_input(commands);
+}
+
+static void benchmark_usart_write_data_string(uint32_t iteration){
+	benchmark_console_idle();
+	usart_write_data_string(BENCHMARK_FORMAT, iteration % NUMBER_OF_SERVOS, iteration, iteration % 100);
+}
+
+// The suite, in the order it runs and prints
+static const benchmark_case benchmark_cases[] = {
+	{"get_instruction", NULL, benchmark_get_instruction, NULL},
+	{"recipe_step", benchmark_recipe_step_setup, benchmark_recipe_step, benchmark_recipe_step_teardown},
+	{"process_user_input", NULL, benchmark_process_user_input, NULL},
+	{"usart_write_data_string", NULL, benchmark_usart_write_data_string, NULL},
+};
+
+/*
+	Helper function that finds what reading the cycle counter twice costs, so it can
+	be taken off every timing
+
+	Output:
+		The fewest cycles an empty timing took
+*/
+static uint32_t benchmark_calibrate(){
+	uint32_t fewest = 0xFFFFFFFF;
+	uint32_t start;
+	uint32_t cycles;
+
+	for(int count = 0; count < BENCHMARK_CALIBRATIONS; count++){
+		start = hal_cycles_now();
+		cycles = hal_cycles_now() - start;
+		if(cycles < fewest){
+			fewest = cycles;
+		}
+	}
+	return fewest;
+}
+
+/*
+	This function times one benchmark case.  The average comes from the quickest of
+	BENCHMARK_BATCHES batches of BENCHMARK_BATCH_SIZE calls, so neither the counter's
+	resolution nor an interrupt in one batch moves it much, then BENCHMARK_ITERATIONS
+	calls are timed one at a time for the worst call
+
+	Input:
+		benchmark - The case to time
+		result    - Filled in with what was measured
+*/
+void benchmark_run(const benchmark_case *benchmark, benchmark_result *result){
+	uint32_t overhead = benchmark_calibrate();
+	uint32_t fewest = 0xFFFFFFFF;
+	uint32_t worst = 0;
+	uint32_t iteration = 0;
+	uint32_t start;
+	uint32_t cycles;
+
+	if(benchmark->setup != NULL){
+		benchmark->setup();
+	}
+	for(int batch = 0; batch < BENCHMARK_BATCHES; batch++){
+		start = hal_cycles_now();
+		for(int call = 0; call < BENCHMARK_BATCH_SIZE; call++){
+			benchmark->run(iteration++);
+		}
+		cycles = hal_cycles_now() - start;
+		cycles = (cycles > overhead) ? (cycles - overhead) : 0;
+		if(cycles < fewest){
+			fewest = cycles;
+		}
+	}
+	for(iteration = 0; iteration < BENCHMARK_ITERATIONS; iteration++){
+		start = hal_cycles_now();
+		benchmark->run(iteration);
+		cycles = hal_cycles_now() - start;
+		cycles = (cycles > overhead) ? (cycles - overhead) : 0;
+		if(cycles > worst){
+			worst = cycles;
+		}
+	}
+	if(benchmark->teardown != NULL){
+		benchmark->teardown();
+	}
+
+	result->name = benchmark->name;
+	result->cycles_per_operation = fewest / BENCHMARK_BATCH_SIZE;
+	result->worst_cycles = worst;
+	result->operations_per_second = (fewest == 0) ? 0 : (uint32_t)(((uint64_t)SystemCoreClock * BENCHMARK_BATCH_SIZE) / fewest);
+}
+
+/*
+	This function times every case in the suite
+
+	Input:
+		results - Filled in with what every case measured, MAX_BENCHMARKS long
+
+	Output:
+		The number of cases that ran
+*/
+int benchmark_run_all(benchmark_result *results){
+	int count = sizeof(benchmark_cases) / sizeof(benchmark_cases[0]);
+
+	for(int index = 0; index < count; index++){
+		benchmark_run(&benchmark_cases[index], &results[index]);
+	}
+	return count;
+}
+
+/*
+	This function prints a line for every case that was timed
+
+	Input:
+		results - What every case measured
+		count   - The number of cases
+*/
+void benchmark_print(benchmark_result *results, int count){
+	benchmark_console_idle();
+	usart_write_simple("");
+	usart_write_data_string("Benchmarks, best of %d batches of %d calls at %d Mhz:", BENCHMARK_BATCHES, BENCHMARK_BATCH_SIZE, SystemCoreClock / 1000000);
+	for(int index = 0; index < count; index++){
+		usart_write_data_string("  %-24s %8u cycles/op %10u ops/s %8u worst",
+			results[index].name, results[index].cycles_per_operation,
+			results[index].operations_per_second, results[index].worst_cycles);
+	}
+}
+
+/*
+	This function prints the stack high water mark, then runs one call of every case
+	to see how much stack its call path uses, interrupts that land during it included
+*/
+void benchmark_stack_print(){
+	uint32_t high_water = stack_high_water();
+	uint32_t size = stack_size();
+	int count = sizeof(benchmark_cases) / sizeof(benchmark_cases[0]);
+	const benchmark_case *benchmark;
+	uint32_t depth[MAX_BENCHMARKS];
+	uint32_t *from;
+
+	usart_write_simple("");
+	for(int index = 0; index < count; index++){
+		benchmark = &benchmark_cases[index];
+		if(benchmark->setup != NULL){
+			benchmark->setup();
+		}
+		stack_paint();
+		from = hal_stack_pointer();
+		benchmark->run(0);
+		depth[index] = stack_depth(from);
+		if(benchmark->teardown != NULL){
+			benchmark->teardown();
+		}
+	}
+
+	benchmark_console_idle();
+	usart_write_data_string("Stack: %u of %u bytes used at most (%u%%)", high_water, size, (high_water * STACK_PERCENT) / size);
+	for(int index = 0; index < count; index++){
+		usart_write_data_string("  %-24s %6u bytes", benchmark_cases[index].name, depth[index]);
+	}
+}
+
+/*
+	The self test's software interrupt, it only notes the cycle it started on
+*/
+void TIM7_IRQHandler(void){
+	self_test_entry_cycles = hal_cycles_now();
+	self_test_interrupted = 1;
+}
+
+/*
+	Helper function that times the console sending a few lines of dashes, from the
+	first byte queued to the last one handed to the USART
+
+	Output:
+		The bytes per second the console sent
+*/
+static uint32_t self_test_tx_throughput(){
+	char line[SELF_TEST_TX_LINE + 1];
+	uint32_t bytes = 0;
+	uint32_t start;
+	uint32_t elapsed;
+
+	memset(line, '-', SELF_TEST_TX_LINE);
+	line[SELF_TEST_TX_LINE] = 0;
+	benchmark_console_idle();
+	start = hal_timebase_now();
+	for(int count = 0; count < SELF_TEST_TX_LINES; count++){
+		usart_write_simple(line);
+		bytes += SELF_TEST_TX_LINE + strlen(CARRIAGE_RETURN_NEWLINE);
+	}
+	benchmark_console_idle();
+	elapsed = hal_timebase_now() - start;
+	return (elapsed == 0) ? 0 : (uint32_t)(((uint64_t)bytes * TICKS_PER_MILLISECOND * 1000) / elapsed);
+}
+
+/*
+	Helper function that times how long the core takes to get into an interrupt
+	handler, one software interrupt at a time
+
+	Input:
+		fewest  - Filled in with the quickest entry, in cycles
+		average - Filled in with the average entry
+		most    - Filled in with the slowest entry
+*/
+static void self_test_interrupt_latency(uint32_t *fewest, uint32_t *average, uint32_t *most){
+	uint32_t overhead = benchmark_calibrate();
+	uint32_t total = 0;
+	uint32_t start;
+	uint32_t cycles;
+
+	*fewest = 0xFFFFFFFF;
+	*most = 0;
+	NVIC_SetPriority(SELF_TEST_IRQ, SELF_TEST_PRIORITY);
+	NVIC_EnableIRQ(SELF_TEST_IRQ);
+	for(int count = 0; count < SELF_TEST_INTERRUPTS; count++){
+		self_test_interrupted = 0;
+		start = hal_cycles_now();
+		hal_self_test_interrupt();
+		while(!self_test_interrupted){
+		}
+		cycles = self_test_entry_cycles - start;
+		cycles = (cycles > overhead) ? (cycles - overhead) : 0;
+		total += cycles;
+		if(cycles < *fewest){
+			*fewest = cycles;
+		}
+		if(cycles > *most){
+			*most = cycles;
+		}
+	}
+	NVIC_DisableIRQ(SELF_TEST_IRQ);
+	*average = total / SELF_TEST_INTERRUPTS;
+}
+
+static void self_test_deadline(void *context){
+	self_test_deadline_passed = 1;
+}
+
+static int self_test_before_deadline(void *context){
+	return !self_test_deadline_passed;
+}
+
+/*
+	Helper function that measures how late a task gets to run after a timing wheel
+	deadline, which is when a servo gets its next pulse width.  Each deadline lands
+	at a different point of the wheel tick, so the spread is the update jitter
+
+	Input:
+		earliest - Filled in with the least late the task ran, in microseconds
+		latest   - Filled in with the most late it ran
+*/
+static void self_test_deadline_jitter(uint32_t *earliest, uint32_t *latest){
+	wheel_timer timer = {NULL};
+	uint32_t deadline;
+	uint32_t late;
+
+	*earliest = 0xFFFFFFFF;
+	*latest = 0;
+	for(int count = 0; count < SELF_TEST_DEADLINES; count++){
+		deadline = hal_timebase_now() + SELF_TEST_DEADLINE_TIME + ((count * WHEEL_TICK_TIME) / SELF_TEST_DEADLINES);
+		self_test_deadline_passed = 0;
+		timing_wheel_schedule(&timer, deadline, self_test_deadline, NULL);
+		delay_wait_while(self_test_before_deadline, NULL);
+		late = hal_timebase_now() - deadline;
+		if(late < *earliest){
+			*earliest = late;
+		}
+		if(late > *latest){
+			*latest = late;
+		}
+	}
+}
+
+/*
+	This function runs the self test and prints what it measured.  It takes a few
+	tens of milliseconds, and the idle time is what the board had before it started
+*/
+void benchmark_self_test(){
+	int idle = idle_percentage();
+	uint32_t rx_cycles = hal_serial_rx_worst_cycles();
+	benchmark_result interpreter;
+	uint32_t tx_rate;
+	uint32_t entry_fewest;
+	uint32_t entry_average;
+	uint32_t entry_most;
+	uint32_t earliest;
+	uint32_t latest;
+
+	benchmark_console_idle();
+	usart_write_simple("");
+	usart_write_data_string("Self test at %d Mhz:", SystemCoreClock / 1000000);
+	tx_rate = self_test_tx_throughput();
+	benchmark_run(&benchmark_cases[SELF_TEST_INTERPRETER_CASE], &interpreter);
+	self_test_interrupt_latency(&entry_fewest, &entry_average, &entry_most);
+	self_test_deadline_jitter(&earliest, &latest);
+
+	usart_write_data_string("  Console TX  %10u bytes/s", tx_rate);
+	usart_write_data_string("  Console RX  %10u bytes/s at most, %u cycles worst to take a byte",
+		(rx_cycles == 0) ? 0 : SystemCoreClock / rx_cycles, rx_cycles);
+	usart_write_data_string("  Interpreter %10u steps/s, %u cycles each", interpreter.operations_per_second, interpreter.cycles_per_operation);
+	usart_write_data_string("  ISR entry   %10u cycles fewest, %u average, %u most", entry_fewest, entry_average, entry_most);
+	usart_write_data_string("  Deadlines   %10u us jitter, %u to %u us late", latest - earliest, earliest, latest);
+	usart_write_data_string("  Idle        %10d%%", idle);
+}
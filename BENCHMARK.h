@@ -0,0 +1,49 @@
+/*
+  Function declarations for the benchmark suite of the interpreter, parser and
+  formatter hot paths
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function times one benchmark case, the average over the quickest batch of
+	calls and the worst of BENCHMARK_ITERATIONS calls timed one at a time
+
+	Input:
+		benchmark - The case to time
+		result    - Filled in with what was measured
+*/
+void benchmark_run(const benchmark_case *benchmark, benchmark_result *result);
+
+/*
+	This function times every case in the suite
+
+	Input:
+		results - Filled in with what every case measured, MAX_BENCHMARKS long
+
+	Output:
+		The number of cases that ran
+*/
+int benchmark_run_all(benchmark_result *results);
+
+/*
+	This function prints a line for every case that was timed
+
+	Input:
+		results - What every case measured
+		count   - The number of cases
+*/
+void benchmark_print(benchmark_result *results, int count);
+
+/*
+	This function runs the self test and prints what it measured: console throughput,
+	interpreter steps per second, interrupt entry latency, deadline jitter and idle time
+*/
+void benchmark_self_test(void);
+
+/*
+	This function prints the stack high water mark, then runs one call of every case
+	to see how much stack its call path uses
+*/
+void benchmark_stack_print(void);
@@ -25,6 +25,14 @@
 #define OPERATIONAL_CODE_MASK (224) 										 // This represents the following: 0b11100000
 #define PARAMETER_MASK (31) 														 // This represents the following: 0b00011111
 
+// Every piece of controller state is declared INSTANCE.  On the board it is nothing, the
+// fleet simulator gathers it into one section that it swaps for each simulated controller
+#ifdef FLEET_BUILD
+#define INSTANCE __attribute__((section("controller_state")))
+#else
+#define INSTANCE
+#endif
+
 // General defines
 #define MAX_DELAY (1000)																 // The maximum delay time possible for moving a servo
 #define SERVO_0 (0)																			 // Used when selecting timer related items for servo 0
@@ -36,19 +44,20 @@
 #define INSIDE_RECIPE_LOOP (1)													 // Used to determine if we are inside a recipe loop
 #define LOOP_END_COUNT (0)															 // Used to determine the of the end of a recipe loop
 #define RECIPE_LOOP_MODIFIER (1)												 // We subtract one from the loop count to get the length not the size
-#define MICROSECOND_CONVERSION (10000)									 // Used for determining the delay time in Helper.c
 #define WAIT_TIME_CONVERSION (100)											 // Used for the WAIT opcode (represents 1/10 of a second)
 #define MAX_RECIPE_SIZE (100)														 // Used to determine the maximum recipe size
 #define NUMBER_OF_RECIPES (6)													   // The number of test recipes
-#define NUMBER_OF_SERVOS (2)														 // The number of motors we can move
-#define OUTPUT_BUFFER_SIZE (2000)                        // Arbitrary bad code, I know
-#define COMMAND_BUFFER_SIZE (2)													 // Used for setting the current command for each motor 
+#define NUMBER_OF_HARDWARE_SERVOS (2)										 // The number of motors driven by the TIM2 PWM channels
+#define NUMBER_OF_SOFT_PWM_SERVOS (14)									 // The number of motors driven by the DMA to GPIO software PWM (PC0 to PC13)
+#define NUMBER_OF_PWM_CHANNELS (NUMBER_OF_HARDWARE_SERVOS + NUMBER_OF_SOFT_PWM_SERVOS) // Every motor move_servo can address
+#define NUMBER_OF_SERVOS (NUMBER_OF_PWM_CHANNELS)        // The number of motors the console and recipes drive, the TIM2 ones first
+#define SCRATCH_SLOTS (1)                                // Spare servo_data and recipe slots past the real ones for the benchmarks, so Q and M never touch a running servo
+#define OUTPUT_BUFFER_SIZE (160)                         // Two console lines, longer formatted output is cut short
+#define USART_WAIT_WHEN_FULL (0)                         // Writes wait for room in the TX buffer, the console does this
+#define USART_DROP_WHEN_FULL (1)                         // Lines that do not fit in the TX buffer are dropped, for output nobody waits on
+#define COMMAND_BUFFER_SIZE (NUMBER_OF_SERVOS)           // Used for setting the current command for each motor, one letter per servo
 #define SUCCESS (1)                                      // Used for some int returning functions
 #define FAILURE (0)                                      // Used for some int returning functions
-#define VALID_X  ("Xx")                                  // Used to check if the user enered X's into the prompt
-#define VALID_P  ("Pp")                                  // Used to check if the user enered p's into the prompt
-#define VALID_Y  ("Yy")                           			 // Used to check if the user wants to continue recipe execution after error
-#define VALID_YES_NO  ("YyNn")                           // Used to check if the user wants to continue recipe execution after error
 #define ASCII_NEWLINE  (13)                              // Used to check for newlines
 #define ASCII_BACKSPACE (127)	   												 // Used to check for backspaces
 #define ASCII_TERMINAL_CHARACTER (62)										 // This character is used for the input terminal
@@ -56,7 +65,28 @@
 #define NO_NEWLINE (0)                                   // Tells the real time printer not to print a newline
 #define REAL_TIME_BUFFER_SIZE (1)                        // Used to output the users input in real time
 #define REAL_TIME_BUFFER_START (0)                       // Used for printing out real time data as its entered in
+#define LINE_EDITOR_BUSY (0)                             // The line editor is still waiting for the rest of the line
+#define LINE_EDITOR_DONE (1)                             // The line editor has a whole command line
+#define LINE_EDITOR_CANCELLED (2)                        // The user threw the line away with an X
+#define COMMAND_QUEUE_SIZE (4)                           // Command lines that can be typed ahead of the dispatcher
+#define COMMAND_LINE_SIZE (64)                           // The longest command line, it can hold many command sets
+#define COMMAND_TABLE_SIZE (256)                         // One command table entry for every byte value
+#define COMMAND_FLAG_NONE (0x0000)                       // The byte means nothing to the console
+#define COMMAND_FLAG_SERVO (0x0001)                      // The byte is a servo command, its handler runs it
+#define COMMAND_FLAG_RECIPE (0x0002)                     // The servo command starts a recipe running
+#define COMMAND_FLAG_ONCE (0x0004)                       // The servo command is for the whole board, run it once a set
+#define COMMAND_FLAG_CANCEL (0x0008)                     // The byte throws the command line away
+#define COMMAND_FLAG_BACKSPACE (0x0010)                  // The byte removes the last character of the line
+#define COMMAND_FLAG_NEWLINE (0x0020)                    // The byte finishes the command line
+#define COMMAND_FLAG_DIGIT (0x0040)                      // The byte is part of a repeat count or servo number
+#define COMMAND_FLAG_DELIMITER (0x0080)                  // The byte separates the command sets on a line
+#define COMMAND_FLAG_STOP (0x0100)                       // The byte is the emergency stop, the RX interrupt handles it
+#define COMMAND_FLAG_FIRST_SERVO (0x0200)                // The number before the byte is the servo a command set starts at
+#define COMMAND_REPEAT_DEFAULT (1)                       // A command set without a repeat count runs once
+#define MAX_COMMAND_REPEAT (99)                          // Bigger repeat counts are cut down to this
+#define FIRST_SERVO_DEFAULT (0)                          // A command set without a servo number starts at servo 0
 #define CARRIAGE_RETURN_NEWLINE ("\r\n")                 // Used in strings in the program
+#define IDLE_PERCENT (100)                               // Used to turn the idle time into a percentage
 #define DASHES ("--------------------------------------------------------------------------------") // Used to make printing look nice
 
 // General use 
@@ -85,40 +115,127 @@
 #define TIMER_2_AUTOLOAD_PRELOAD (0x00000080)						 // Set TIM2 to autoload preloaded values
 #define TIMER_2_CHAN1_CHAN2_ENABLE_OUTPUT (0x00000011)	 // Enable channel 1 and 2 as output on TIM2
 
-// Define our CHAN 1 Timer, used for timing the 
-// movement of servo 0
-// Defines for the TIM3 timer to make the constants more human readbale
-#define TIMER_3_ENABLE (RCC_APB1ENR1_TIM3EN)             // This allow us to enable the TIM3 timer
-#define TIMER_3 (RCC->APB1ENR1)                          // The timer 2 register
-#define TIMER_3_PRESCALER (TIM3->PSC)                    // The timer 2 presclater 
-#define TIMER_3_PRESCALER_ENABLE (TIM3->EGR)             // Memory are for enabling the prescaler for TIM3
-#define TIMER_3_PRESCALER_FORCE_LOAD (TIM_EGR_UG)        // Force the reload of the precaler value
-#define TIMER_3_CAPTURE_INPUT (TIM3->CCER)               // The TIM3 input memory area
-#define TIMER_3_CAPTURE_COMPARE (TIM3->CCMR1)            // The TIM3 capture/compare memory area
-#define TIMER_3_CAPTURE  (TIM3->CR1)                     // The memory area to enable capturing
-#define TIMER_3_CLOCK_TIMER_RESULTS (TIM3->CCR1)         // The TIM3 clock (where we get the measurement results)
-#define TIMER_3_COUNT (TIM3->CNT)                        // The TIM3 count
-#define TIMER_3_CAPTURE_SET_TO_INPUT (ENABLE)            // Set capture compare to input
-#define TIMER_3_ENABLE_INPUT_CAPTURE (ENABLE)            // Enable input capture
-#define TIMER_3_DISABLE_INPUT_CAPTURE (DISABLE)          // Disable input capture
-#define TIMER_3_4_PRESCLAER_RATIO (8000)                 // The TIM3 and TIM4 timer starts in 80Mhz so divide it by 80 so we match the GPIO clock rate of 1Mhz
-
-// Define our CHAN 2 Timer, used for timing the 
-// movement of servo 1
-// Defines for the TIM4 timer to make the constants more human readbale
-#define TIMER_4_ENABLE (RCC_APB1ENR1_TIM4EN)             // This allow us to enable the TIM4 timer
-#define TIMER_4 (RCC->APB1ENR1)                          // The timer 4 register
-#define TIMER_4_PRESCALER (TIM4->PSC)                    // The timer 4 presclater 
-#define TIMER_4_PRESCALER_ENABLE (TIM4->EGR)             // Memory are for enabling the prescaler for TIM4
-#define TIMER_4_PRESCALER_FORCE_LOAD (TIM_EGR_UG)        // Force the reload of the precaler value
-#define TIMER_4_CAPTURE_INPUT (TIM4->CCER)               // The TIM4 input memory area
-#define TIMER_4_CAPTURE_COMPARE (TIM4->CCMR1)            // The TIM4 capture/compare memory area
-#define TIMER_4_CAPTURE  (TIM4->CR1)                     // The memory area to enable capturing
-#define TIMER_4_CLOCK_TIMER_RESULTS (TIM4->CCR1)         // The TIM4 clock (where we get the measurement results)
-#define TIMER_4_COUNT (TIM4->CNT)                        // The TIM4 count
-#define TIMER_4_CAPTURE_SET_TO_INPUT (ENABLE)            // Set capture compare to input
-#define TIMER_4_ENABLE_INPUT_CAPTURE (ENABLE)            // Enable input capture
-#define TIMER_4_DISABLE_INPUT_CAPTURE (DISABLE)          // Disable input capture
+// Defines for the TIM5 timer, a free running 32 bit count that every servo shares as its clock.
+// At 1Mhz it wraps every ~71 minutes, so deadlines are compared with wrap safe subtraction
+#define TIMEBASE_CLOCK (RCC->APB1ENR1)                   // The TIM5 clock register
+#define TIMEBASE_ENABLE (RCC_APB1ENR1_TIM5EN)            // This allows us to enable the TIM5 timer
+#define TIMEBASE_TIMER (TIM5)                            // TIM5 is one of the two 32 bit timers on the board
+#define TIMEBASE_COUNT (TIM5->CNT)                       // The TIM5 count, the current time in microseconds
+#define TIMEBASE_PRESCALER (79)                          // 80Mhz / 80 gives a 1Mhz count, one count per microsecond
+#define TIMEBASE_RELOAD (0xFFFFFFFF)                     // Count through the whole 32 bits before wrapping
+#define TICKS_PER_MILLISECOND (1000)                     // Used to turn millisecond delays into timebase counts
+#define TIMEBASE_COMPARE (TIM5->CCR1)                    // TIM5 channel 1 compare, drives the timing wheel
+#define TIMEBASE_INTERRUPTS (TIM5->DIER)                 // The TIM5 interrupt enable register
+#define TIMEBASE_STATUS (TIM5->SR)                       // The TIM5 status register
+#define TIMEBASE_COMPARE_INTERRUPT (TIM_DIER_CC1IE)      // Interrupt when the count reaches the compare value
+#define TIMEBASE_COMPARE_FLAG (TIM_SR_CC1IF)             // Set when the count reaches the compare value
+#define TIMEBASE_IRQ (TIM5_IRQn)                         // The TIM5 interrupt
+#define TIMEBASE_PRIORITY (2)                            // Below the DMA refills, deadlines are only millisecond accurate
+#define DELAY_CALIBRATION_TIME (1000)                    // Microseconds of timebase used to measure the core clock
+#define DELAY_DEFAULT_CYCLES_PER_MICROSECOND (80)        // The 80Mhz core clock, used until the calibration is done
+#define DELAY_YIELD_THRESHOLD (2 * WHEEL_TICK_TIME)      // Waits shorter than this just count cycles
+#define USART_2_PRIORITY (0)                             // Above everything so an emergency stop is never held up, it must not touch the timing wheel
+#define EMERGENCY_STOP_BYTE (3)                          // Ctrl-C, stops every servo straight from the RX interrupt
+#define EMERGENCY_STOP_CLEAR (0)                         // No emergency stop is latched
+#define EMERGENCY_STOP_LATCHED (1)                       // Every running servo was paused and no moves are taken until it is released
+
+// Defines for the cooperative scheduler.  A task's number is also its priority, the lowest
+// number with events waiting runs first, so the order here is the order work gets done in
+#define MAX_TASKS (32)                                   // One bit per task in the ready mask
+#define NO_TASK (-1)                                     // Signalling this does nothing
+#define TASK_TX_DRAIN (0)                                // Keeps the UART busy, it only ever moves a byte or two
+#define TASK_RECIPE_SERVO_0 (1)                          // Servo n's recipe interpreter is TASK_RECIPE_SERVO_0 + n
+#define TASK_CONSOLE (TASK_RECIPE_SERVO_0 + NUMBER_OF_SERVOS) // Feeds typed bytes to the line editor
+#define TASK_DISPATCHER (TASK_CONSOLE + 1)               // Runs the command sets the line editor finished
+#define TASK_TELEMETRY (TASK_DISPATCHER + 1)             // Prints the status of every servo now and then
+#define TASK_TRACE (TASK_TELEMETRY + 1)                  // Sends the waveform trace, last so it never holds up the servos
+#define TASK_EVENT_START (0x01)                          // A recipe was started or continued from the console
+#define TASK_EVENT_DEADLINE (0x02)                       // A servo deadline passed on the timing wheel
+#define TASK_EVENT_RX (0x04)                             // A byte arrived on USART2
+#define TASK_EVENT_TX (0x08)                             // USART2 is ready for another byte
+#define TASK_EVENT_PERIOD (0x10)                         // A periodic timer fired
+#define TASK_EVENT_CONTINUE (0x20)                       // A task ran out of its budget and has more to do
+#define TASK_EVENT_LINE (0x40)                           // The line editor finished a command set
+#define TASK_EVENT_STOP (0x80)                           // The emergency stop was hit
+#define TASK_EVENT_TRACE (0x100)                         // The waveform trace has a frame worth of records
+#define RECIPE_STEPS_PER_RUN (8)                         // Recipe instructions a servo runs before letting other tasks in
+#define TELEMETRY_PERIOD (1000)                          // Milliseconds between telemetry frames
+#define TELEMETRY_ON (1)                                 // Print telemetry frames
+#define TELEMETRY_OFF (0)                                // Do not print telemetry frames
+#define TELEMETRY_DEFAULT (TELEMETRY_OFF)                // Frames get in the way of typing, so they start off
+
+// Defines for the hierarchical timing wheel.  Level 0 holds the next 256 ticks one slot per
+// tick, level 1 the next ~16 seconds 256 ticks per slot, level 2 the next ~17 minutes
+#define WHEEL_TICK_TIME (TICKS_PER_MILLISECOND)         // One wheel tick is one millisecond on the timebase
+#define WHEEL_LEVEL_0_BITS (8)                           // Level 0 has 256 slots
+#define WHEEL_LEVEL_BITS (6)                             // Levels 1 and 2 have 64 slots
+#define WHEEL_LEVEL_0_SIZE (1 << WHEEL_LEVEL_0_BITS)     // The number of slots in level 0
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)         // The number of slots in levels 1 and 2
+#define WHEEL_LEVEL_0_MASK (WHEEL_LEVEL_0_SIZE - 1)      // Picks a level 0 slot out of a tick
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)          // Picks a level 1 or 2 slot out of a shifted tick
+#define WHEEL_LEVEL_1_SHIFT (WHEEL_LEVEL_0_BITS)         // Ticks per level 1 slot is 1 << 8
+#define WHEEL_LEVEL_2_SHIFT (WHEEL_LEVEL_0_BITS + WHEEL_LEVEL_BITS) // Ticks per level 2 slot is 1 << 14
+#define WHEEL_BITS_PER_WORD (32)                         // Used to keep one occupied bit per level 0 slot
+#define WHEEL_MAX_TICKS ((1 << (WHEEL_LEVEL_2_SHIFT + WHEEL_LEVEL_BITS)) - 1) // Anything further out is parked and cascaded again
+
+// Defines for streaming trajectories into the TIM2 CCR registers with a DMA burst on
+// every TIM2 update event (one update event is one 20ms servo period)
+#define DMA_1_ENABLE (RCC_AHB1ENR_DMA1EN)                // This allows us to enable the DMA1 controller
+#define DMA_1 (RCC->AHB1ENR)                             // The DMA1 clock register
+#define DMA_1_STATUS (DMA1->ISR)                         // The DMA1 interrupt status register
+#define DMA_1_CLEAR_STATUS (DMA1->IFCR)                  // The DMA1 interrupt flag clear register
+#define TRAJECTORY_DMA (DMA1_Channel2)                   // TIM2_UP can only be routed to DMA1 channel 2
+#define TRAJECTORY_DMA_IRQ (DMA1_Channel2_IRQn)          // The interrupt for DMA1 channel 2
+#define DMA_1_REQUEST_SELECT (DMA1_CSELR->CSELR)         // The DMA1 request selection register
+#define TRAJECTORY_DMA_REQUEST_MASK (DMA_CSELR_C2S)      // The request selection bits for channel 2
+#define TRAJECTORY_DMA_REQUEST_TIM2_UP (0x00000040)      // Request 4 on channel 2 is TIM2_UP
+#define TRAJECTORY_DMA_HALF_TRANSFER (DMA_ISR_HTIF2)     // The first half of the buffer has been played
+#define TRAJECTORY_DMA_TRANSFER_COMPLETE (DMA_ISR_TCIF2) // The second half of the buffer has been played
+#define TRAJECTORY_DMA_TRANSFER_ERROR (DMA_ISR_TEIF2)    // The DMA could not reach the timer
+#define TRAJECTORY_DMA_CLEAR (DMA_IFCR_CGIF2)            // Clear every channel 2 flag at once
+#define TRAJECTORY_DMA_CONFIGURATION (DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 | DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_DIR | DMA_CCR_PL_1 | DMA_CCR_TEIE | DMA_CCR_HTIE | DMA_CCR_TCIE) // 32 bit, memory to timer, circular, both halves interrupt
+#define TRAJECTORY_DMA_PRIORITY (1)                      // Refills must happen well inside half a buffer of servo periods
+#define TIMER_2_INTERRUPTS (TIM2->DIER)                  // The TIM2 interrupt and DMA enable register
+#define TIMER_2_UPDATE_DMA (TIM_DIER_UDE)                // Request a DMA transfer on each TIM2 update event
+#define TIMER_2_DMA_CONTROL (TIM2->DCR)                  // The TIM2 DMA burst control register
+#define TIMER_2_DMA_BURST (TIM2->DMAR)                   // The TIM2 DMA burst address, every write lands in the next register of the burst
+#define TIMER_2_DMA_BURST_CCR1 (13)                      // The burst starts at CCR1 (offset 0x34 / 4)
+#define TIMER_2_DMA_BURST_LENGTH_SHIFT (8)               // Where the burst length lives in the DCR register
+#define TRAJECTORY_FRAME_SIZE (NUMBER_OF_HARDWARE_SERVOS) // One CCR value per TIM2 servo channel for every servo period
+#define TRAJECTORY_HALF_FRAMES (16)                      // Number of servo periods in each half of the buffer (320ms)
+#define TRAJECTORY_HALF_SIZE (TRAJECTORY_HALF_FRAMES * TRAJECTORY_FRAME_SIZE) // The number of words in each half of the buffer
+#define TRAJECTORY_BUFFER_SIZE (2 * TRAJECTORY_HALF_SIZE) // The number of words in the whole circular buffer
+#define TRAJECTORY_FIRST_HALF (0)                        // Index of the first half of the buffer
+#define TRAJECTORY_SECOND_HALF (1)                       // Index of the second half of the buffer
+#define TRAJECTORY_LOOP (1)                              // Replay the trajectory from the start when it ends
+#define TRAJECTORY_NO_LOOP (0)                           // Hold the last frame and stop when the trajectory ends
+#define TRAJECTORY_FRAME_TIME (20)                       // Milliseconds each frame plays for, one TIM2 servo period
+#define GLIDE_FRAMES (50)                                // Servo periods a glide from the G command takes, one second
+#define GLIDE_TIME (GLIDE_FRAMES * TRAJECTORY_FRAME_TIME) // Milliseconds until a gliding servo is ready again
+#define GLIDE_TURN_POSITION (ninety_six_degrees)         // A servo below this glides to 160 degrees, anything else back to 0
+#define GLIDE_NONE (0)                                   // No servo has been told to glide
+
+// Defines for the software PWM, TIM6 paces DMA1 channel 3 through a table of BSRR words
+// so every servo on the port gets its pulse without any CPU time.  One slot is 0.1ms,
+// the same tick TIM2 uses, so the duty table in TIMER.c works as a slot count
+#define SOFT_PWM_GPIO (GPIOC)                            // The port the software PWM servos are wired to (channel n is PCn)
+#define SOFT_PWM_GPIO_CLOCK_ENABLE (RCC_AHB2ENR_GPIOCEN) // This allows us to enable the software PWM port
+#define SOFT_PWM_MODE_BITS (2)                           // Every pin has two MODER bits, PC14 and PC15 are the LSE crystal and stay as they are
+#define SOFT_PWM_MODE_MASK (0x3)                         // The MODER bits of one pin
+#define SOFT_PWM_MODE_OUTPUT (0x1)                       // General purpose output mode for one pin
+#define SOFT_PWM_TIMER_ENABLE (RCC_APB1ENR1_TIM6EN)      // This allows us to enable the TIM6 timer
+#define SOFT_PWM_TIMER_CLOCK (RCC->APB1ENR1)             // The TIM6 clock register
+#define SOFT_PWM_TIMER (TIM6)                            // TIM6 only counts, which is all we need to pace the DMA
+#define SOFT_PWM_TIMER_PRESCALER (79)                    // 80Mhz / 80 gives a 1Mhz count
+#define SOFT_PWM_TIMER_RELOAD (99)                       // 1Mhz / 100 gives one slot every 0.1ms
+#define SOFT_PWM_DMA (DMA1_Channel3)                     // TIM6_UP can only be routed to DMA1 channel 3
+#define SOFT_PWM_DMA_REQUEST_MASK (DMA_CSELR_C3S)        // The request selection bits for channel 3
+#define SOFT_PWM_DMA_REQUEST_TIM6_UP (0x00000600)        // Request 6 on channel 3 is TIM6_UP
+#define SOFT_PWM_DMA_CONFIGURATION (DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 | DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_DIR | DMA_CCR_PL_0) // 32 bit, memory to port, circular, no interrupts
+#define SOFT_PWM_SLOTS (TIMER_2_SECOND_PRESCALE_RATIO)   // 200 slots of 0.1ms is one 20ms servo period, the same as TIM2
+#define SOFT_PWM_PERIOD_START (0)                        // Every pulse starts in the first slot
+#define SOFT_PWM_RESET_SHIFT (16)                        // The upper half of BSRR resets pins, the lower half sets them
+#define SOFT_PWM_DISABLED (0)                            // A pulse width of 0 turns the channel off
 
 
 // Defines for the GPIO to make the constants more human readbale
@@ -129,6 +246,78 @@
 #define GPIO_PA0_ALTERNATE_FUNCTION (GPIOA->AFR[0])      // GPIO PIN A 0 alternate function
 #define GPIO_A_PA0_PA1_ALETERNATE_FUNCTION_ENABLE (0x11) // Enable alternate function on PA0 and PA1
 
+// Defines for the user LEDs, LED.c sets the pins up
+#define RED_LED_PORT (GPIOB)                             // LD4 red is on PB2
+#define RED_LED_PIN (GPIO_ODR_ODR_2)                     // The red LED bit in the GPIOB output register
+#define GREEN_LED_PORT (GPIOE)                           // LD5 green is on PE8
+#define GREEN_LED_PIN (GPIO_ODR_ODR_8)                   // The green LED bit in the GPIOE output register
+
+// Defines for the waveform trace.  Every servo pulse width and LED change goes into a ring
+// with its timebase time, and the lowest priority task sends the ring out in bulk frames of
+// TRACE_SYNC, a 16 bit little endian record count and the trace_records themselves
+#define TRACE_RING_SIZE (256)                            // Records the ring holds, a power of two
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)            // Turns a record counter into a ring index
+#define TRACE_FLUSH_SIZE (TRACE_RING_SIZE / 4)           // The most records in one frame, the trace task wakes once this many wait
+#define TRACE_FRAME_MIN (TRACE_FLUSH_SIZE / 8)           // The fewest records the trace task sends at once, smaller frames wait for TX room
+#define TRACE_SYNC ("\0TRC")                             // Starts every frame, the console never sends a NUL so it stands out
+#define TRACE_SYNC_SIZE (4)                              // The bytes in TRACE_SYNC
+#define TRACE_FRAME_HEADER_SIZE (TRACE_SYNC_SIZE + 2)    // TRACE_SYNC and the record count
+#define TRACE_RECORD_SIZE (8)                            // The bytes in one trace_record on the wire
+#define TRACE_KIND_PWM (0)                               // A servo pulse width changed, the value is the new width
+#define TRACE_KIND_LED (1)                               // An LED changed, the value is 1 for on
+#define TRACE_KIND_LOST (2)                              // The ring was full, the value is how many records were dropped
+#define TRACE_LED_RED (0)                                // The channel of the red LED
+#define TRACE_LED_GREEN (1)                              // The channel of the green LED
+#define NUMBER_OF_TRACE_LEDS (2)                         // The LEDs the trace follows
+#define TRACE_UNKNOWN (-1)                               // Nothing recorded for an output since the capture started
+#define TRACE_ON (1)                                     // Capture the waveform trace
+#define TRACE_OFF (0)                                    // Do not capture the waveform trace
+#define TRACE_DEFAULT (TRACE_OFF)                        // The frames are binary, so capture waits to be asked for
+
+// Defines for the benchmark suite.  Every case times batches of calls and then single calls on
+// the cycle counter, less what reading the counter costs, and reports the average and the worst call
+#define BENCHMARK_ITERATIONS (1000)                      // Calls timed one at a time for every case's worst call
+#ifdef HOST_BUILD
+#define BENCHMARK_BATCHES (200)                          // The host core is shared, the quickest of many batches is one nothing else ran in
+#else
+#define BENCHMARK_BATCHES (10)                           // Batches of calls timed for a case's average, the quickest one counts
+#endif
+#define BENCHMARK_BATCH_SIZE (100)                       // Calls in a batch, enough that the counter's resolution hardly shows
+#define BENCHMARK_CALIBRATIONS (64)                      // Empty timings taken to find what reading the counter costs
+#define BENCHMARK_SERVO (NUMBER_OF_SERVOS)               // The scratch servo slot the recipe_step case runs
+#define BENCHMARK_RECIPE (NUMBER_OF_RECIPES)             // The scratch recipe slot the recipe_step case writes its loop into
+#define BENCHMARK_LOOP_COUNT (0x7FFFFFFF)                // END_LOOP keeps jumping back for longer than any run
+#define BENCHMARK_COMMAND_SET ("NN")                     // process_user_input runs a command set that does nothing but dispatch
+#define BENCHMARK_FORMAT ("Servo %d at %d, %d%%")        // usart_write_data_string gets a status line sized format
+#define BENCHMARK_TOLERANCE (50)                         // Percent slower than the baseline before a case counts as a regression, twice as slow always does
+#define MAX_BENCHMARKS (8)                               // The most cases the suite can hold
+
+// Defines for the self test the Q command runs, a quick check of the board's performance
+#define SELF_TEST_TX_LINE (78)                           // Dashes in each line the console throughput is timed on
+#define SELF_TEST_TX_LINES (2)                           // Lines sent, with their newlines they still fit in the TX buffer
+#define SELF_TEST_INTERPRETER_CASE (1)                   // The recipe_step case of the benchmark suite times the interpreter
+#define SELF_TEST_INTERRUPTS (64)                        // Software interrupts timed for the entry latency
+#define SELF_TEST_IRQ (TIM7_IRQn)                        // TIM7 is not used, so its interrupt is borrowed for the latency test
+#define SELF_TEST_PRIORITY (USART_2_PRIORITY)            // Top priority so only the hardware entry is timed
+#define SELF_TEST_DEADLINES (16)                         // Timing wheel deadlines the servo update jitter is measured on
+#define SELF_TEST_DEADLINE_TIME (2 * WHEEL_TICK_TIME)    // How far out each deadline is, the phase against the wheel tick moves each time
+
+// Defines for the stack high water mark.  The stack is painted at reset, and the deepest
+// word that no longer holds the paint is as far as the stack has ever grown
+#define STACK_PAINT (0xC5C5C5C5)                         // Written over the free stack, the startup code uses the same value
+#define STACK_PAINT_MARGIN (8)                           // Words left alone below the painter's own stack pointer
+#define STACK_PERCENT (100)                              // Used to turn the high water mark into a percentage
+
+// Defines for the recipe trace, a ring of every recipe instruction run.  It lives in SRAM2,
+// which the link leaves out, so nothing clears it when the board resets
+#define RETAINED_MEMORY_BASE (SRAM2_BASE)                // Kept over a warm reset while the SRAM2_RST option bit is left at its default
+#define RECIPE_TRACE_SIZE (256)                          // Instructions the ring holds, a power of two
+#define RECIPE_TRACE_MASK (RECIPE_TRACE_SIZE - 1)        // Picks a ring slot out of the count of entries written
+#define RECIPE_TRACE_MAGIC (0x52435054)                  // Marks a ring that was set up before the reset, anything else is power up garbage
+#define RECIPE_TRACE_ALL (RECIPE_TRACE_SIZE)             // Print every entry the ring still holds
+#define RECIPE_TRACE_ON (1)                              // Record the instructions the recipes run
+#define RECIPE_TRACE_OFF (0)                             // Leave the ring alone, the benchmarks run the interpreter with this
+
 // Defines for the degrees the motor can move
 #define ZERO_DEGREES (5)
 #define THIRY_TWO_DEGREES (7)
@@ -144,6 +333,16 @@
 #define RECIPE_LOOP_COUNT_DEFAULT (0)
 #define RECIPE_LOOP_INDEX_DEFAULT (0)
 #define LAST_START_TIME_DEFAULT (0)
+#define DEADLINE_DEFAULT (0)
+#define DEADLINE_EXPIRED_DEFAULT (1)
+#define TASK_DEFAULT (NO_TASK)
+#define FAULT_POLICY_DEFAULT (fault_halt)
+#define FAULT_COUNT_DEFAULT (0)
+#define FAULT_RESTARTS_DEFAULT (0)
+#define FAULT_RESTART_LIMIT (3)                          // Restarts in a row before a restart policy halts the servo
+#define NO_RECIPE (-1)                                   // No recipe is waiting in the shadow slot
+#define SHADOW_RECIPE_INDEX_DEFAULT (NO_RECIPE)
+#define FAULT_PARK_POSITION (zero_degrees)
 #define TARGET_POSITION_DEFAULT (zero_degrees)
 #define TOTAL_DELAY_DEFAULT (0)
 
@@ -162,7 +361,7 @@
 
 // Use these defines for calculating servo delays
 #define ONE_STEP_SERVO_DELAY ((uint16_t)200) 						 // The general time to move a servo one step (in milliseconds)
-#define RECIPE_SERVO_DELAY ((uint16_t)1000)						   // The recipes need a different scale for the time
+#define RECIPE_SERVO_DELAY ((uint16_t)100)						   // A recipe MOV step and one WAIT unit both take a tenth of a second (in milliseconds)
 
 // Keep track of the state of the servo
 typedef enum {
@@ -177,6 +376,15 @@ typedef enum {
 	running,
 } recipe_status;
 
+// What a servo does by itself when its recipe hits a bad instruction
+typedef enum {
+	fault_skip,																// Skip the bad instruction and keep going
+	fault_halt,																// Pause the servo where it is
+	fault_restart,														// Start the recipe over from its first instruction
+	fault_park,																// Move the servo to the park position and pause it
+	END_OF_FAULT_POLICIES											// Used to cycle through the policies
+} fault_policy;
+
 // This enumerator allows us to select positions without # defining each of them
 typedef enum {
 	zero_degrees,															// 0 degrees (4)
@@ -188,21 +396,134 @@ typedef enum {
 	END_OF_POSITION_ARRAY     								// This is just used because its easier to track the array size
 } position;
 
+// A deadline registered with the timing wheel.  The callback runs from the TIM5
+// interrupt, so it should only set flags or schedule more work
+typedef void (*wheel_callback)(void *context);
+typedef struct wheel_timer{
+	struct wheel_timer *next;			// The next timer in the same wheel slot
+	struct wheel_timer *previous;	// The previous timer in the same wheel slot
+	struct wheel_timer **slot;		// The slot this timer is in, NULL when it is not scheduled
+	uint32_t expiry_tick;					// The wheel tick this timer expires on
+	wheel_callback callback;			// What to run when the deadline passes
+	void *context;								// Passed to the callback
+} wheel_timer;
+
+// Called over and over while a delay waits, so the wait can let other work run.  It returns
+// 1 if it did some work, and the pending check tells the wait if there is work it could do
+typedef int (*delay_yield)(void);
+typedef int (*delay_work_pending)(void);
+
+// What a wait is waiting on, it returns 1 for as long as the wait should keep going
+typedef int (*delay_condition)(void *context);
+
+// A run to completion task.  It gets every event flag set since it last ran and must
+// return rather than wait, anything it is waiting on should signal it again
+typedef void (*task_function)(uint32_t events, void *context);
+typedef struct{
+	task_function function;				// What to run, NULL if the task number is not in use
+	void *context;								// Passed to the function
+	volatile uint32_t events;			// The events set since the task last ran
+} task;
+
 // Keep track of various items that describe the state of the servo
 typedef struct{
 	servo_status status;					// This tells us the current state of the servo (paused, or running)
 	position position;						// This tells us the current position each servo is in	
 	int recipe_index;							// This tells us which recipe we are on
+	int shadow_recipe_index;			// The recipe that takes over at the next RECIPE_END or loop boundary, NO_RECIPE if none
 	int recipe_instruction_index; // This tells us which instruction inside of the current recipe we are on
 	int recipe_loop_count;				// This tells us how many times we have looped in a recipe
 	int inside_recipe_loop;				// This tells us if we are inside a loop in a recipe
 	int recipe_loop_index;				// This tells us where we are in each loop inside the recipe
-	uint16_t last_start_time;     // This tells us the last time a motor started moving
+	uint32_t last_start_time;     // This tells us the last time (on the shared timebase) a motor started moving
 	position target_position;			// This is used when calculating if the motor is ready to move again yet
 	uint16_t total_delay;					// This is used when calculating if the motor is ready to move again yet
+	uint32_t deadline;						// The time on the shared timebase when the motor is ready to move again
+	wheel_timer deadline_timer;		// Registered with the timing wheel to flag when the deadline passes
+	volatile int deadline_expired;// Set by the timing wheel once the deadline has passed
+	int task;											// The task signalled when the deadline passes
+	fault_policy fault_policy;		// What to do when the recipe hits a bad instruction
+	int fault_count;							// The number of bad instructions the recipe has hit
+	int fault_restarts;						// Times the fault policy restarted the recipe since it last ran to the end
 	recipe_status recipe_status;  // Used to keep track of the servos while executing recipes
 } servo_data;
 
+// The state of a command line being typed in, so the line editor can be fed one
+// byte at a time and pick up where it left off
+typedef struct{
+	char buffer[COMMAND_LINE_SIZE + 1];		// The command line so far, always NULL terminated
+	int length;														// The number of characters in the buffer
+} line_editor;
+
+// One command table entry, what kind of byte it is and the handler for servo commands
+typedef void (*command_handler)(int servo_index);
+typedef struct{
+	command_handler handler;	// Runs the command on one servo, NULL for anything that is not a servo command
+	uint16_t flags;						// The COMMAND_FLAG bits for the byte
+} command_entry;
+
+// One waveform trace entry, TRACE_RECORD_SIZE bytes with the fields in this order
+typedef struct{
+	uint32_t time;						// The timebase time of the change, in microseconds
+	uint8_t kind;							// TRACE_KIND_PWM, TRACE_KIND_LED or TRACE_KIND_LOST
+	uint8_t channel;					// The servo or LED that changed
+	uint16_t value;						// The new pulse width or LED state, or the records lost
+} trace_record;
+
+// One benchmark case, the setup and teardown are untimed and may be NULL
+typedef struct{
+	char *name;										// What is being timed, also the key in the baseline file
+	void (*setup)(void);					// Gets the program ready to run the case
+	void (*run)(uint32_t iteration);	// One timed call
+	void (*teardown)(void);				// Puts everything the setup changed back
+} benchmark_case;
+
+// What one benchmark case measured, in core clock cycles
+typedef struct{
+	char *name;										// The case that was timed
+	uint32_t cycles_per_operation;	// The average call
+	uint32_t worst_cycles;				// The slowest call, interrupts included
+	uint32_t operations_per_second;	// How many average calls fit in a second of core clock
+} benchmark_result;
+
+// What one servo's recipes have done since the controller started
+typedef struct{
+	uint32_t instructions;				// Recipe instructions started, a move or wait still going is not counted again
+	uint32_t moves;								// MOV instructions started
+	uint32_t waits;								// WAIT instructions started
+	uint32_t loops;								// Times an END_LOOP jumped back
+	uint32_t faults;							// Bad instructions handed to the fault policy
+} servo_counters;
+
+// One recipe trace entry, a fixed 8 bytes written with a few stores
+typedef struct{
+	uint32_t time;								// The timebase time the instruction started, in microseconds
+	uint8_t servo;								// The servo that ran it
+	uint8_t recipe;								// The recipe it is in
+	uint8_t index;								// Where it is in the recipe
+	uint8_t instruction;					// The instruction byte, opcode and parameter
+} recipe_trace_entry;
+
+// The recipe trace ring and what it needs to be found again after a warm reset
+typedef struct{
+	uint32_t magic;								// RECIPE_TRACE_MAGIC once the ring is set up
+	uint32_t written;							// Entries written since power up, the ring slot is this masked
+	uint32_t resets;							// Warm resets the ring has been kept over
+	recipe_trace_entry entries[RECIPE_TRACE_SIZE];
+} recipe_trace_buffer;
+
+// The runtime counters, each one is a single increment where the thing happens
+typedef struct{
+	servo_counters servos[NUMBER_OF_SERVOS + SCRATCH_SLOTS];
+	volatile uint32_t bytes_in;		// Console bytes received, counted by the RX interrupt
+	uint32_t bytes_out;						// Console bytes queued to send
+	volatile uint32_t rx_overruns;// Console bytes lost on the way in, to a hardware overrun or a full buffer
+	uint32_t tx_full;							// Console bytes that found the TX buffer full and had to wait for room
+	uint32_t tx_dropped;						// Telemetry lines dropped because the TX buffer had no room for them
+	uint32_t loop_iterations;			// Tasks run by the scheduler loop
+	uint32_t loop_worst_cycles;		// The longest a task has held the loop
+} counter_registry;
+
 // Use a struct to contain the current opcode and parameter while processing
 // recipes
 typedef struct{
@@ -211,6 +532,15 @@ typedef struct{
 } current_instruction;
 
 // Define the array that we will carry our pulse width data in
-extern int positions[END_OF_POSITION_ARRAY];																										
+extern int positions[END_OF_POSITION_ARRAY];
+
+// Set while the waveform trace is captured, checked inline by the HAL
+extern INSTANCE int trace_enabled;
+
+// The runtime counters, in COUNTERS.c
+extern INSTANCE counter_registry counters;
+
+// The command table, indexed by the byte that was typed
+extern const command_entry command_table[COMMAND_TABLE_SIZE];																										
 
 #endif
@@ -0,0 +1,58 @@
+/*
+  The counters file keeps the runtime counters: what every servo's recipes have
+  done, the console traffic and how the scheduler loop is keeping up.  Every counter
+  lives in the one counter_registry, and the hot paths update it with a single
+  increment where the thing happens, so counting costs next to nothing.  The I
+  command and the telemetry frames print it
+*/
+
+#include "COUNTERS.h"
+#include "HAL.h"
+#include "Helper.h"
+#include "DELAY.h"
+
+// The runtime counters
+INSTANCE counter_registry counters;
+
+// Where the loop rate window started
+static INSTANCE uint32_t counters_window_start;
+static INSTANCE uint32_t counters_window_iterations;
+
+/*
+	This function starts the first window for the loop rate.  The counters start at
+	zero with the rest of RAM, so bytes that came in during boot are still counted
+*/
+void counters_init(){
+	counters_window_start = hal_timebase_now();
+	counters_window_iterations = counters.loop_iterations;
+}
+
+/*
+	This function prints every counter.  The loop rate is over the time since the
+	counters were last printed
+*/
+void counters_print(){
+	uint32_t window_length = hal_timebase_now() - counters_window_start;
+	uint32_t iterations = counters.loop_iterations - counters_window_iterations;
+	servo_counters *servo;
+
+	usart_write_simple("Counters:");
+	for(int servo_index = 0; servo_index < NUMBER_OF_SERVOS; servo_index++){
+		servo = &counters.servos[servo_index];
+
+		// A software PWM servo only gets a line once it has run a recipe, so the idle
+		// ones don't bury the rest
+		if((servo_index >= NUMBER_OF_HARDWARE_SERVOS) && (servo->instructions == 0)){
+			continue;
+		}
+		usart_write_data_string("  Servo %d: %u instructions, %u moves, %u waits, %u loops, %u faults",
+			servo_index, servo->instructions, servo->moves, servo->waits, servo->loops, servo->faults);
+	}
+	usart_write_data_string("  Console: %u bytes in, %u bytes out, %u RX overruns, %u bytes waited for TX room, %u lines dropped",
+		counters.bytes_in, counters.bytes_out, counters.rx_overruns, counters.tx_full, counters.tx_dropped);
+	usart_write_data_string("  Loop: %u tasks/s, %u tasks run, longest %u cycles (%u us)",
+		(window_length == 0) ? 0 : (uint32_t)(((uint64_t)iterations * TICKS_PER_MILLISECOND * 1000) / window_length),
+		counters.loop_iterations, counters.loop_worst_cycles, cycles_to_us(counters.loop_worst_cycles));
+	counters_window_start = hal_timebase_now();
+	counters_window_iterations = counters.loop_iterations;
+}
@@ -0,0 +1,18 @@
+/*
+  Function declarations for the runtime counters
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function starts the first window for the loop rate.  The counters start at
+	zero with the rest of RAM, so bytes that came in during boot are still counted
+*/
+void counters_init(void);
+
+/*
+	This function prints every counter.  The loop rate is over the time since the
+	counters were last printed
+*/
+void counters_print(void);
@@ -0,0 +1,175 @@
+/*
+  The delay file is the one place the program waits for time to pass.  Short waits
+  count DWT cycles, which is exact no matter how the code was compiled.  Long waits
+  let the timing wheel wake us just before the deadline and yield (or sleep) until
+  then, so no cycles are burned waiting
+*/
+
+#include "DELAY.h"
+#include "TIMER.h"
+#include "TIMING_WHEEL.h"
+#include "POWER.h"
+#include "HAL.h"
+
+// The core clock measured against the timebase, in cycles per microsecond
+static INSTANCE uint32_t cycles_per_microsecond = DELAY_DEFAULT_CYCLES_PER_MICROSECOND;
+
+// What to do while waiting, NULL sleeps until the next interrupt
+static INSTANCE delay_yield delay_yield_function = NULL;
+static INSTANCE delay_work_pending delay_work_pending_function = NULL;
+
+/*
+	The timing wheel runs this once a wait is nearly over.  There is nothing to do
+	here, the interrupt itself is what wakes the core back up
+*/
+static void delay_wakeup(void *context){
+}
+
+/*
+	The wait condition for delay_until, keep waiting until the wake time
+
+	Input:
+		context - Points at the wake time on the shared timebase
+*/
+static int delay_before(void *context){
+	return !time_reached(*(uint32_t *)context);
+}
+
+/*
+	This function starts the DWT cycle counter and calibrates it against the TIM5
+	timebase, so delays do not depend on compiler optimisation or flash wait states.
+	timebase_init must have already started TIM5
+*/
+void delay_init(){
+	uint32_t start_time;
+	uint32_t start_cycles;
+
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// Count the cycles in a known stretch of the timebase
+	start_time = now();
+	start_cycles = cycles_now();
+	while((now() - start_time) < DELAY_CALIBRATION_TIME);
+	cycles_per_microsecond = (cycles_now() - start_cycles + (DELAY_CALIBRATION_TIME / 2)) / DELAY_CALIBRATION_TIME;
+	if(cycles_per_microsecond == 0){
+		cycles_per_microsecond = DELAY_DEFAULT_CYCLES_PER_MICROSECOND;
+	}
+}
+
+/*
+	Helper function that returns the current DWT cycle count
+
+	Output: The number of core clock cycles since delay_init, wrapping every ~53 seconds
+*/
+uint32_t cycles_now(){
+	return hal_cycles_now();
+}
+
+/*
+	Helper function that turns a number of cycles into microseconds using the
+	calibrated core clock
+
+	Input:
+		cycles - A number of core clock cycles
+
+	Output:
+		The number of microseconds those cycles take
+*/
+uint32_t cycles_to_us(uint32_t cycles){
+	return cycles / cycles_per_microsecond;
+}
+
+/*
+	This function replaces the default idle sleep used during long waits.  With a
+	yield function in place waits let other work run instead of sleeping
+
+	Input:
+		yield   - The function to call over and over while waiting, NULL to sleep instead.
+		          It returns 1 if it did some work
+		pending - Tells a wait about to sleep if yield has work it could do, may be NULL
+*/
+void delay_set_yield(delay_yield yield, delay_work_pending pending){
+	delay_yield_function = yield;
+	delay_work_pending_function = pending;
+}
+
+/*
+	This function waits for as long as a condition holds, yielding while there is
+	other work to do and sleeping while there is not.  Whatever ends the wait has to
+	come with an interrupt, since that is the only thing that wakes the core up
+
+	Input:
+		waiting - Returns 1 for as long as the wait should keep going
+		context - Passed to waiting
+*/
+void delay_wait_while(delay_condition waiting, void *context){
+	while(waiting(context)){
+		if((delay_yield_function != NULL) && delay_yield_function()){
+			continue;
+		}
+
+		// Check both again with interrupts off, so a wakeup can not slip in before the sleep
+		__disable_irq();
+		if(waiting(context) && ((delay_work_pending_function == NULL) || !delay_work_pending_function())){
+			idle_enter();
+		}
+		__enable_irq();
+	}
+}
+
+/*
+	This function waits until a time on the shared timebase, yielding (or sleeping)
+	until just before it and then finishing on the timebase for microsecond accuracy
+
+	Input:
+		deadline - The time on the shared timebase to wait for
+*/
+void delay_until(uint32_t deadline){
+	wheel_timer wakeup = {NULL};
+
+	// The wheel only fires on tick boundaries, so wake up a tick early and finish by hand
+	uint32_t wake_time = deadline - WHEEL_TICK_TIME;
+
+	if(time_before(now(), wake_time)){
+		timing_wheel_schedule(&wakeup, wake_time, delay_wakeup, NULL);
+		delay_wait_while(delay_before, &wake_time);
+
+		// The wakeup lives on our stack, so make sure the wheel is done with it
+		timing_wheel_cancel(&wakeup);
+	}
+
+	while(!time_reached(deadline));
+}
+
+/*
+	This function waits a number of microseconds.  Short waits count DWT cycles,
+	longer ones yield (or sleep) through the timing wheel
+
+	Input:
+		delay_time - The number of microseconds to wait
+*/
+void delay_us(uint32_t delay_time){
+	uint32_t start_cycles = cycles_now();
+	uint32_t wait_cycles;
+
+	if(delay_time >= DELAY_YIELD_THRESHOLD){
+		delay_until(now() + delay_time);
+		return;
+	}
+
+	wait_cycles = delay_time * cycles_per_microsecond;
+	while((cycles_now() - start_cycles) < wait_cycles);
+}
+
+/*
+	This function waits a number of milliseconds, yielding (or sleeping) through
+	the timing wheel
+
+	Input:
+		delay_time - The number of milliseconds to wait
+*/
+void delay_ms(uint32_t delay_time){
+	delay_until(deadline_after(now(), delay_time));
+}
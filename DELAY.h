@@ -0,0 +1,81 @@
+/*
+  Function declarations for the delay and timestamp service
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function starts the DWT cycle counter and calibrates it against the TIM5
+	timebase, so delays do not depend on compiler optimisation or flash wait states.
+	timebase_init must have already started TIM5
+*/
+void delay_init(void);
+
+/*
+	Helper function that returns the current DWT cycle count
+
+	Output: The number of core clock cycles since delay_init, wrapping every ~53 seconds
+*/
+uint32_t cycles_now(void);
+
+/*
+	Helper function that turns a number of cycles into microseconds using the
+	calibrated core clock
+
+	Input:
+		cycles - A number of core clock cycles
+
+	Output:
+		The number of microseconds those cycles take
+*/
+uint32_t cycles_to_us(uint32_t cycles);
+
+/*
+	This function replaces the default idle sleep used during long waits.  With a
+	yield function in place waits let other work run instead of sleeping
+
+	Input:
+		yield   - The function to call over and over while waiting, NULL to sleep instead.
+		          It returns 1 if it did some work
+		pending - Tells a wait about to sleep if yield has work it could do, may be NULL
+*/
+void delay_set_yield(delay_yield yield, delay_work_pending pending);
+
+/*
+	This function waits for as long as a condition holds, yielding while there is
+	other work to do and sleeping while there is not.  Whatever ends the wait has to
+	come with an interrupt, since that is the only thing that wakes the core up
+
+	Input:
+		waiting - Returns 1 for as long as the wait should keep going
+		context - Passed to waiting
+*/
+void delay_wait_while(delay_condition waiting, void *context);
+
+/*
+	This function waits until a time on the shared timebase, yielding (or sleeping)
+	until just before it and then finishing on the timebase for microsecond accuracy
+
+	Input:
+		deadline - The time on the shared timebase to wait for
+*/
+void delay_until(uint32_t deadline);
+
+/*
+	This function waits a number of microseconds.  Short waits count DWT cycles,
+	longer ones yield (or sleep) through the timing wheel
+
+	Input:
+		delay_time - The number of microseconds to wait
+*/
+void delay_us(uint32_t delay_time);
+
+/*
+	This function waits a number of milliseconds, yielding (or sleeping) through
+	the timing wheel
+
+	Input:
+		delay_time - The number of milliseconds to wait
+*/
+void delay_ms(uint32_t delay_time);
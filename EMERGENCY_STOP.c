@@ -0,0 +1,110 @@
+/*
+  The emergency stop file stops every servo straight from the USART2 RX interrupt
+  when the stop byte arrives, without waiting on any task.  The PWM outputs are
+  frozen at their current duty, every running servo is paused, and the time the stop took
+  is measured on the DWT cycle counter so the worst case can be reported
+*/
+
+#include "EMERGENCY_STOP.h"
+#include "TRAJECTORY.h"
+#include "DELAY.h"
+#include "SCHEDULER.h"
+
+// The servos to pause when the stop is hit
+static INSTANCE servo_data *emergency_stop_motors = NULL;
+
+// Set from the moment the stop is hit until it is released
+static INSTANCE volatile int emergency_stop_state = EMERGENCY_STOP_CLEAR;
+
+// How long the last stop and the slowest stop took, in core clock cycles.  A stop
+// takes well under a microsecond, so microseconds would just read 0
+static INSTANCE volatile uint32_t emergency_stop_last_cycles;
+static INSTANCE volatile uint32_t emergency_stop_worst_cycles;
+
+/*
+	This function tells the emergency stop which servos to pause
+
+	Input:
+		motors - The array of motor struct refernces, NUMBER_OF_SERVOS long
+*/
+void emergency_stop_init(servo_data *motors){
+	emergency_stop_motors = motors;
+	emergency_stop_state = EMERGENCY_STOP_CLEAR;
+	emergency_stop_last_cycles = 0;
+	emergency_stop_worst_cycles = 0;
+}
+
+/*
+	This function stops everything.  It is run from the USART2 RX interrupt, which
+	has the highest priority in the program, so nothing can hold it up.  It only
+	touches the PWM and the servo structs, never the timing wheel
+
+	The TIM2 compare registers and the software PWM table are left as they are, so
+	every servo holds the duty it has right now.  Only a trajectory could change
+	them on its own, so that is stopped
+
+	Input:
+		start_cycles - The cycle count when the RX interrupt was entered
+*/
+void emergency_stop(uint32_t start_cycles){
+	uint32_t reaction_cycles;
+
+	emergency_stop_state = EMERGENCY_STOP_LATCHED;
+	trajectory_stop();
+	if(emergency_stop_motors != NULL){
+		for(int servo_num = 0; servo_num < NUMBER_OF_SERVOS; servo_num++){
+
+			// An inactive servo has no recipe to hold, it stays inactive
+			if(emergency_stop_motors[servo_num].status == active){
+				emergency_stop_motors[servo_num].status = paused;
+			}
+		}
+	}
+
+	// Keep track of how long it took, the dispatcher prints it
+	reaction_cycles = cycles_now() - start_cycles;
+	emergency_stop_last_cycles = reaction_cycles;
+	if(reaction_cycles > emergency_stop_worst_cycles){
+		emergency_stop_worst_cycles = reaction_cycles;
+	}
+	task_signal(TASK_DISPATCHER, TASK_EVENT_STOP);
+}
+
+/*
+	Helper function to tell if the emergency stop is latched.  No moves are
+	taken while it is
+
+	Output:
+		1 if the stop was hit and not released yet, 0 otherwise
+*/
+int emergency_stop_active(){
+	return (emergency_stop_state == EMERGENCY_STOP_LATCHED);
+}
+
+/*
+	This function releases the emergency stop so servos can be moved again.  The
+	servos stay paused until they are continued or restarted
+*/
+void emergency_stop_release(){
+	emergency_stop_state = EMERGENCY_STOP_CLEAR;
+}
+
+/*
+	Helper function that returns how long the last emergency stop took
+
+	Output:
+		The core clock cycles from entering the RX interrupt to every running servo paused
+*/
+uint32_t emergency_stop_reaction_cycles(){
+	return emergency_stop_last_cycles;
+}
+
+/*
+	Helper function that returns how long the slowest emergency stop took
+
+	Output:
+		The worst reaction time since power up, in core clock cycles
+*/
+uint32_t emergency_stop_worst_reaction_cycles(){
+	return emergency_stop_worst_cycles;
+}
@@ -0,0 +1,59 @@
+/*
+  Function declarations for the emergency stop handled in the USART2 RX interrupt
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function tells the emergency stop which servos to pause
+
+	Input:
+		motors - The array of motor struct refernces, NUMBER_OF_SERVOS long
+*/
+void emergency_stop_init(servo_data *motors);
+
+/*
+	This function stops everything.  It is run from the USART2 RX interrupt, which
+	has the highest priority in the program, so nothing can hold it up.  It only
+	touches the PWM and the servo structs, never the timing wheel
+
+	The TIM2 compare registers and the software PWM table are left as they are, so
+	every servo holds the duty it has right now.  Only a trajectory could change
+	them on its own, so that is stopped
+
+	Input:
+		start_cycles - The cycle count when the RX interrupt was entered
+*/
+void emergency_stop(uint32_t start_cycles);
+
+/*
+	Helper function to tell if the emergency stop is latched.  No moves are
+	taken while it is
+
+	Output:
+		1 if the stop was hit and not released yet, 0 otherwise
+*/
+int emergency_stop_active(void);
+
+/*
+	This function releases the emergency stop so servos can be moved again.  The
+	servos stay paused until they are continued or restarted
+*/
+void emergency_stop_release(void);
+
+/*
+	Helper function that returns how long the last emergency stop took
+
+	Output:
+		The core clock cycles from entering the RX interrupt to every running servo paused
+*/
+uint32_t emergency_stop_reaction_cycles(void);
+
+/*
+	Helper function that returns how long the slowest emergency stop took
+
+	Output:
+		The worst reaction time since power up, in core clock cycles
+*/
+uint32_t emergency_stop_worst_reaction_cycles(void);
@@ -0,0 +1,416 @@
+/*
+  The hardware abstraction layer is the only way the program logic touches the
+  board: servo PWM output, the TIM5 timebase and DWT cycle counter, the USART2
+  console and the two user LEDs.  Every function is static inline, so on the board
+  each one compiles down to the same register access or driver call the logic
+  used to make by itself.  Building with HOST_BUILD defined binds the same
+  functions to hal_host_ software versions instead, so the recipe interpreter,
+  the command parser and the scheduler can be built with gcc on a Linux host.
+  The console is the exception, it goes through the UART.c driver either way and
+  the host models the USART2 registers under it
+*/
+#ifndef _HAL_
+#define _HAL_
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+#include "TRACE.h"
+#include "UART.h"
+
+#ifdef HOST_BUILD
+
+/*
+	The software versions of the hardware, supplied by whatever host program the
+	logic is built into
+*/
+void hal_host_pwm_write(int channel, int pulse_width);
+void hal_host_trajectory_start(uint32_t *buffer, uint32_t words);
+void hal_host_trajectory_stop(void);
+uint32_t hal_host_timebase_now(void);
+void hal_host_timebase_arm(uint32_t compare_time);
+void hal_host_timebase_disarm(void);
+void hal_host_timebase_clear(void);
+uint32_t hal_host_cycles_now(void);
+void hal_host_usart_transmit(uint8_t data);
+void hal_host_led_red(int on);
+void hal_host_led_green(int on);
+void hal_host_trace_write(uint8_t *data, uint32_t length);
+uint32_t hal_host_trace_room(void);
+void hal_host_self_test_interrupt(void);
+uint32_t *hal_host_stack_bottom(void);
+uint32_t *hal_host_stack_top(void);
+uint32_t *hal_host_stack_pointer(void);
+void *hal_host_retained_memory(void);
+
+#else
+
+#include "SOFT_PWM.h"
+
+// The stack from the startup code, and the vector table whose first entry is its top
+extern uint32_t Stack_Mem[];
+extern uint32_t __Vectors[];
+
+#endif
+
+/*
+	This function sets the pulse width of any servo channel.  The TIM2 channels come
+	first, every servo number after them is a software PWM channel, so callers never
+	need to know which kind of output drives a servo
+
+	Input:
+		channel     - The servo to drive (0 to NUMBER_OF_PWM_CHANNELS - 1)
+		pulse_width - The pulse width, usually an entry from the positions table
+*/
+__STATIC_INLINE void hal_pwm_write(int channel, int pulse_width){
+	if(trace_enabled){
+		trace_event(TRACE_KIND_PWM, channel, pulse_width);
+	}
+#ifdef HOST_BUILD
+	hal_host_pwm_write(channel, pulse_width);
+#else
+	if(channel == SERVO_0){
+		TIMER_2_MOTOR_1 = pulse_width;
+	}
+	else if(channel == SERVO_1){
+		TIMER_2_MOTOR_2 = pulse_width;
+	}
+	else {
+		soft_pwm_set_width(channel - NUMBER_OF_HARDWARE_SERVOS, pulse_width);
+	}
+#endif
+}
+
+/*
+	This function starts the DMA burst that plays a trajectory buffer into the TIM2
+	CCRs, one frame on every TIM2 update event.  The buffer is circular and the DMA
+	interrupt comes after each half of it
+
+	Input:
+		buffer - The circular buffer, TRAJECTORY_FRAME_SIZE words per frame
+		words  - The number of words in the buffer
+*/
+__STATIC_INLINE void hal_trajectory_start(uint32_t *buffer, uint32_t words){
+#ifdef HOST_BUILD
+	hal_host_trajectory_start(buffer, words);
+#else
+	DMA_1_CLEAR_STATUS = TRAJECTORY_DMA_CLEAR;
+	TRAJECTORY_DMA->CMAR = (uint32_t)(uintptr_t)buffer;
+	TRAJECTORY_DMA->CNDTR = words;
+	TRAJECTORY_DMA->CCR |= DMA_CCR_EN;
+	TIMER_2_INTERRUPTS |= TIMER_2_UPDATE_DMA;
+#endif
+}
+
+/*
+	This function stops the trajectory DMA burst, the TIM2 CCRs keep the last frame
+*/
+__STATIC_INLINE void hal_trajectory_stop(void){
+#ifdef HOST_BUILD
+	hal_host_trajectory_stop();
+#else
+	TIMER_2_INTERRUPTS &= ~TIMER_2_UPDATE_DMA;
+	TRAJECTORY_DMA->CCR &= ~DMA_CCR_EN;
+	DMA_1_CLEAR_STATUS = TRAJECTORY_DMA_CLEAR;
+#endif
+}
+
+/*
+	Helper function that reads the shared timebase
+
+	Output:
+		The number of microseconds since timebase_init, wrapping every ~71 minutes
+*/
+__STATIC_INLINE uint32_t hal_timebase_now(void){
+#ifdef HOST_BUILD
+	return hal_host_timebase_now();
+#else
+	return TIMEBASE_COUNT;
+#endif
+}
+
+/*
+	This function points the timebase compare at a time and turns its interrupt on
+
+	Input:
+		compare_time - The time on the shared timebase the interrupt should fire at
+*/
+__STATIC_INLINE void hal_timebase_arm(uint32_t compare_time){
+#ifdef HOST_BUILD
+	hal_host_timebase_arm(compare_time);
+#else
+	TIMEBASE_COMPARE = compare_time;
+	TIMEBASE_INTERRUPTS |= TIMEBASE_COMPARE_INTERRUPT;
+#endif
+}
+
+/*
+	This function turns the timebase compare interrupt off
+*/
+__STATIC_INLINE void hal_timebase_disarm(void){
+#ifdef HOST_BUILD
+	hal_host_timebase_disarm();
+#else
+	TIMEBASE_INTERRUPTS &= ~TIMEBASE_COMPARE_INTERRUPT;
+#endif
+}
+
+/*
+	This function clears a timebase compare match that has not been handled yet
+*/
+__STATIC_INLINE void hal_timebase_clear(void){
+#ifdef HOST_BUILD
+	hal_host_timebase_clear();
+#else
+	TIMEBASE_STATUS = ~TIMEBASE_COMPARE_FLAG;
+#endif
+}
+
+/*
+	Helper function that reads the core cycle counter
+
+	Output:
+		The number of core clock cycles counted so far, wrapping with 32 bits
+*/
+__STATIC_INLINE uint32_t hal_cycles_now(void){
+#ifdef HOST_BUILD
+	return hal_host_cycles_now();
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+/*
+	This function queues bytes to go out of the console
+
+	Input:
+		data   - The bytes to send
+		length - The number of bytes to send
+*/
+__STATIC_INLINE void hal_serial_write(uint8_t *data, uint32_t length){
+	counters.bytes_out += length;
+	USART_Write(USART2, data, length);
+}
+
+/*
+	This function waits for the next byte from the console
+
+	Output:
+		The byte that was read
+*/
+__STATIC_INLINE char hal_serial_read(void){
+	return USART_Read(USART2);
+}
+
+/*
+	This function reads the next byte from the console without waiting
+
+	Output:
+		The byte that was read, 0 if nothing was waiting
+*/
+__STATIC_INLINE char hal_serial_read_no_block(void){
+	return USART_Read_No_Block(USART2);
+}
+
+/*
+	Helper function to check for console input without reading it
+
+	Output:
+		1 if a byte is waiting to be read, 0 otherwise
+*/
+__STATIC_INLINE int hal_serial_data_available(void){
+	return USART_Data_Available(USART2);
+}
+
+/*
+	This function hands queued console output to the hardware
+*/
+__STATIC_INLINE void hal_serial_tx_drain(void){
+	USART_Tx_Drain(USART2);
+}
+
+/*
+	This function waits, asleep, until all the queued console output has been handed
+	to the hardware.  No other task runs in the meantime
+*/
+__STATIC_INLINE void hal_serial_tx_flush(void){
+	USART_Tx_Flush(USART2);
+}
+
+/*
+	Helper function to tell how much console output has not been handed to the
+	hardware yet
+
+	Output:
+		The number of bytes still queued
+*/
+__STATIC_INLINE uint32_t hal_serial_tx_pending(void){
+	return USART_Tx_Pending(USART2);
+}
+
+/*
+	Helper function to tell how much console output fits before a write has to wait
+
+	Output:
+		The number of bytes the TX buffer still has room for
+*/
+__STATIC_INLINE uint32_t hal_serial_tx_free(void){
+	return USART_Tx_Free(USART2);
+}
+
+/*
+	Helper function to tell how long the console receive interrupt takes to store a
+	byte, which bounds how fast bytes can come in
+
+	Output:
+		The most core clock cycles it has taken
+*/
+__STATIC_INLINE uint32_t hal_serial_rx_worst_cycles(void){
+	return USART_Rx_Worst_Cycles(USART2);
+}
+
+/*
+	This function turns the red LED on or off
+
+	Input:
+		on - 1 to turn the LED on, 0 to turn it off
+*/
+__STATIC_INLINE void hal_led_red(int on){
+	if(trace_enabled){
+		trace_event(TRACE_KIND_LED, TRACE_LED_RED, on);
+	}
+#ifdef HOST_BUILD
+	hal_host_led_red(on);
+#else
+	if(on){
+		RED_LED_PORT->ODR |= RED_LED_PIN;
+	}
+	else {
+		RED_LED_PORT->ODR &= ~RED_LED_PIN;
+	}
+#endif
+}
+
+/*
+	This function turns the green LED on or off
+
+	Input:
+		on - 1 to turn the LED on, 0 to turn it off
+*/
+__STATIC_INLINE void hal_led_green(int on){
+	if(trace_enabled){
+		trace_event(TRACE_KIND_LED, TRACE_LED_GREEN, on);
+	}
+#ifdef HOST_BUILD
+	hal_host_led_green(on);
+#else
+	if(on){
+		GREEN_LED_PORT->ODR |= GREEN_LED_PIN;
+	}
+	else {
+		GREEN_LED_PORT->ODR &= ~GREEN_LED_PIN;
+	}
+#endif
+}
+
+/*
+	This function sends a piece of a waveform trace frame.  The frames share the
+	console with everything else, the simulator can keep them in a file instead
+
+	Input:
+		data   - The bytes to send
+		length - How many there are
+*/
+__STATIC_INLINE void hal_trace_write(uint8_t *data, uint32_t length){
+	counters.bytes_out += length;
+#ifdef HOST_BUILD
+	hal_host_trace_write(data, length);
+#else
+	USART_Write(USART2, data, length);
+#endif
+}
+
+/*
+	Helper function to tell how much of a waveform trace frame goes out without
+	waiting.  On the console that is the room left in the TX buffer
+
+	Output:
+		The number of bytes hal_trace_write takes right now
+*/
+__STATIC_INLINE uint32_t hal_trace_room(void){
+#ifdef HOST_BUILD
+	return hal_host_trace_room();
+#else
+	return USART_Tx_Free(USART2);
+#endif
+}
+
+/*
+	Helper function that finds the lowest word of the stack, where it would overflow
+
+	Output:
+		The first word of the stack
+*/
+__STATIC_INLINE uint32_t *hal_stack_bottom(void){
+#ifdef HOST_BUILD
+	return hal_host_stack_bottom();
+#else
+	return Stack_Mem;
+#endif
+}
+
+/*
+	Helper function that finds the top of the stack, where it starts at reset
+
+	Output:
+		One past the last word of the stack
+*/
+__STATIC_INLINE uint32_t *hal_stack_top(void){
+#ifdef HOST_BUILD
+	return hal_host_stack_top();
+#else
+	return (uint32_t *)__Vectors[0];
+#endif
+}
+
+/*
+	Helper function that reads the stack pointer
+
+	Output:
+		The lowest word the caller is using
+*/
+__STATIC_INLINE uint32_t *hal_stack_pointer(void){
+#ifdef HOST_BUILD
+	return hal_host_stack_pointer();
+#else
+	return (uint32_t *)__get_MSP();
+#endif
+}
+
+/*
+	Helper function that finds the memory kept over a warm reset.  On the board it is
+	SRAM2, which the link leaves out so the startup code never clears it
+
+	Output:
+		The start of the retained memory, it holds a recipe_trace_buffer
+*/
+__STATIC_INLINE void *hal_retained_memory(void){
+#ifdef HOST_BUILD
+	return hal_host_retained_memory();
+#else
+	return (void *)RETAINED_MEMORY_BASE;
+#endif
+}
+
+/*
+	This function raises the self test's software interrupt, SELF_TEST_IRQ, which
+	runs as soon as interrupts allow
+*/
+__STATIC_INLINE void hal_self_test_interrupt(void){
+#ifdef HOST_BUILD
+	hal_host_self_test_interrupt();
+#else
+	NVIC_SetPendingIRQ(SELF_TEST_IRQ);
+#endif
+}
+
+#endif
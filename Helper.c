@@ -3,79 +3,110 @@
 */
 
 #include "Helper.h"
-#include "Timer.h"
+#include "TIMER.h"
+#include "TIMING_WHEEL.h"
+#include "DELAY.h"
+#include "SCHEDULER.h"
+#include "EMERGENCY_STOP.h"
+#include "HAL.h"
+#include "TRAJECTORY.h"
+
+// The frames of the last glide and where it leaves each TIM2 servo
+static INSTANCE uint32_t glide_frames[GLIDE_FRAMES * TRAJECTORY_FRAME_SIZE];
+static INSTANCE position glide_end[TRAJECTORY_FRAME_SIZE];
+
+// The names of the fault policies, in the same order as the enum
+static char *fault_policy_names[END_OF_FAULT_POLICIES] = {
+	"skip",
+	"halt",
+	"restart",
+	"park"
+};
 
 /*
-  Check the input string and see if we have a valid character in it.
-  Used to check the user input
-
-  Input: input - The string to check if it is in valid characters
-         valid_characters - A string of valid characters input should
-                            be checked against
-  Output: An integer for success (1) if the input string contained any 
-          valid characters or failure (0) if it didn't
-*/
-int check_for_valid_input(char *input, char *valid_characters){
-  if(!strpbrk(input, valid_characters)){
-    return FAILURE;
-  }
-  return SUCCESS;
-}
+	Helper function that returns the name of a fault policy for printing
 
-/*
-	Helper function to check if the user wishes to continue
+	Input:
+		policy - The fault policy
 
 	Output:
-		An integer indicating that the user wishes to continue
+		The name of the policy
 */
-int check_for_continuation(){
-	char input = NULL;
-	int keep_going = 0;
-	usart_write_simple("Do you wish to skip to the next instruction? (Yy or Nn):");
-	usart_terminal_character_simple();
-	input = usart_read_simple();
-
-	// Write out what the user wrote
-	usart_real_time_write(input, PRINT_NEWLINE);
-
-	// Get valid input
-	while(!check_for_valid_input(&input, VALID_YES_NO)){
-		usart_write_simple("");
-		usart_write_data_string("Invalid input (%c) please enter Yy or Nn:", input);
-		usart_terminal_character_simple();
-		input = usart_read_simple();
-
-		// Write out what the user wrote
-		usart_real_time_write(input, PRINT_NEWLINE);
+char *fault_policy_name(fault_policy policy){
+	if((policy < fault_skip) || (policy >= END_OF_FAULT_POLICIES)){
+		return "unknown";
 	}
+	return fault_policy_names[policy];
+}
 
-	// Check if the user wants to continue
-	if(check_for_valid_input(&input, VALID_Y)){
-		keep_going = 1;
-	}
-	return keep_going;
+/*
+	This function moves a servo on to its next fault policy and lets the user know
+	which one it is using now
+
+	Input:
+		index - The motor servo data index
+		motor - The motor struct refernce to update
+*/
+void cycle_fault_policy(int index, servo_data *motor){
+	motor->fault_policy = (fault_policy)((motor->fault_policy + 1) % END_OF_FAULT_POLICIES);
+	usart_write_simple("");
+	usart_write_data_string("Servo %d will %s on a recipe fault", index, fault_policy_name(motor->fault_policy));
 }
 
 /*
-  Helper function to keep the board form doing anythiung else until
-  reset is pushed, unless the user wishes to continue
+	This function handles a bad recipe instruction on one servo using that servo's
+	fault policy, without asking the user anything.  The other servos never notice,
+	and the fault is logged with a single line on the buffered console output
+
+	Input:
+		index - The motor servo data index
+		motor - The motor struct refernce of the servo that hit the fault
 
 	Output:
-		An integer indicating that the user wishes to continue
+		1 if the caller should skip the bad instruction, 0 if the policy already
+		took care of the servo
 */
-int exit_program(){
-	int keep_going = 0;
-	keep_going = check_for_continuation();
-
-	// Check if the user wants to keep going and if not, 
-	// 'exit' the program
-	if(!keep_going){
-		usart_write_simple("Exiting the program");
-		while(1);
-	}
+int handle_recipe_fault(int index, servo_data *motor){
+	fault_policy policy = motor->fault_policy;
 
-	// Return if we don't 'exit' first
-	return keep_going;
+	// A fault that comes back every time would restart the recipe forever, so
+	// give up and halt once it has been restarted too many times in a row
+	if((policy == fault_restart) && (motor->fault_restarts >= FAULT_RESTART_LIMIT)){
+		policy = fault_halt;
+	}
+	motor->fault_count++;
+	counters.servos[index].faults++;
+
+	// One line is all the fault gets, a recipe faulting on every pass would fill the
+	// TX buffer with traces.  The recipe trace keeps the instructions for 'D'
+	usart_write_data_string("Servo %d fault in recipe %d at instruction %d, the servo will %s, 'D' shows the recipe trace",
+		index, motor->recipe_index, motor->recipe_instruction_index, fault_policy_name(policy));
+
+	switch(policy){
+		case fault_skip:
+			return SUCCESS;
+		case fault_restart:
+			motor->fault_restarts++;
+
+			// Start over from the first instruction, the first move puts the servo where it needs to be
+			motor->recipe_instruction_index = RECIPE_INSTRUCTION_INDEX_DEFAULT;
+			motor->recipe_loop_count = RECIPE_LOOP_COUNT_DEFAULT;
+			motor->recipe_loop_index = RECIPE_LOOP_INDEX_DEFAULT;
+			motor->inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
+			motor->recipe_status = idle;
+			break;
+		case fault_park:
+			move_servo(index, motor, FAULT_PARK_POSITION, NON_RECIPE_MOVE);
+			motor->status = paused;
+			motor->recipe_status = idle;
+			break;
+		case fault_halt:
+		default:
+			motor->status = paused;
+			motor->recipe_status = idle;
+			break;
+	}
+	return FAILURE;
 }
 
 /*
@@ -84,31 +115,44 @@ int exit_program(){
 void print_banner(){
   usart_write_simple("");
 	usart_write_simple("Enter commands to control motor execution");
-	usart_write_simple("   --The first letter controls the first servo");
-	usart_write_simple("   --The second letter controls the second servo");
+	usart_write_simple("   --The first letter controls servo 0, the second servo 1 and so on up to servo 15");
+	usart_write_simple("   --Servos 0 and 1 are on TIM2 (PA0, PA1), servos 2 to 15 on the software PWM (PC0 to PC13)");
+	usart_write_simple("   --A command set can stop early, the servos after it are left alone");
+	usart_write_simple("   --A servo number and ':' start the set at that servo, '5:LR' is L on servo 5 and R on 6");
 	usart_write_simple("   --Available letters:");
 	usart_write_simple("      --L or l: Turn the servo left if possible");
 	usart_write_simple("      --R or r: Turn the servo right if possible");
+	usart_write_simple("      --G or g: Glide the servo smoothly to the far end of its travel over a second");
 	usart_write_simple("      --C or c: Continue execution of a recipe on the servo");
 	usart_write_simple("      --P or p: Pause execution of a recipe on the servo");
 	usart_write_simple("      --N or n: No op on the servo");
 	usart_write_simple("      --B or b: Begin execution of a recipe on the servo immediately");
+	usart_write_simple("      --S or s: Show the state of the servo");
+	usart_write_simple("      --T or t: Turn the telemetry frames on or off");
+	usart_write_simple("      --W or w: Start or stop the binary waveform trace of the servos and LEDs");
+	usart_write_simple("      --Q or q: Run a quick self test and print how the board is performing");
+	usart_write_simple("      --I or i: Show the runtime counters of the servos, the console and the task loop");
+	usart_write_simple("      --M or m: Show how much of the stack has been used, overall and by the hot call paths");
+	usart_write_simple("      --D or d: Dump the recipe trace, the last instructions run, kept over a warm reset");
+	usart_write_simple("      --F or f: Change what the servo does on a recipe fault (skip, halt, restart, park)");
+	usart_write_simple("      --H or h: Load the next recipe, it takes over at the next loop or recipe end");
+	usart_write_simple("   --Commands are taken while recipes run, a running servo has to be paused before moving it");
+	usart_write_simple("   --Ctrl-C: Emergency stop, every servo holds where it is, running ones are paused");
+	usart_write_simple("     the next command set releases the stop");
 	usart_write_simple("Example: Enter 'Cc' to begin recipe execution on each servo");
+	usart_write_simple("Many command sets can go on one line, split by spaces, commas or semicolons,");
+	usart_write_simple("and a number in front repeats a set.  Example: 'RN,3NR;SS'");
 }
 
 /*
-	This function handles delaying by a number of milliseconds
+	This function handles delaying by a number of milliseconds.  The delay service
+	times it on the timebase and yields (or sleeps) until it is over
 
 	Input: 
 		delay_time - The number of milliseconds to delay
  **/
 void delay(uint32_t delay_time) {
-
-	// Convert to microseconds
-	delay_time = (MICROSECOND_CONVERSION * delay_time);
-
-	// Do nothing for a while!  Hopefully this doesn't get compiled out ...
-	for(uint32_t index = 0; index < delay_time; index++);
+	delay_ms(delay_time);
 }
 
 /*
@@ -137,6 +181,48 @@ uint16_t calculate_delay(position last_position, position new_position, int reci
 	return total_delay;
 }
 
+/*
+	The timing wheel runs this from the TIM5 interrupt once a servo deadline has
+	passed, so nothing has to poll the timebase to find out.  The servo's task is
+	woken up to carry on with whatever it was waiting for
+
+	Input:
+		context - The motor struct refernce the deadline belongs to
+*/
+static void servo_deadline_expired(void *context){
+	servo_data *motor = (servo_data *)context;
+	motor->deadline_expired = 1;
+	task_signal(motor->task, TASK_EVENT_DEADLINE);
+}
+
+/*
+	This function starts a servo delay on the shared timebase and registers the
+	deadline with the timing wheel
+
+	Input:
+		motor      - The motor struct refernce to update
+		start_time - The time on the shared timebase the delay starts at
+		delay_time - The number of milliseconds until the servo is ready again
+*/
+void schedule_servo_deadline(servo_data *motor, uint32_t start_time, uint16_t delay_time){
+	motor->last_start_time = start_time;
+	motor->total_delay = delay_time;
+	motor->deadline = deadline_after(start_time, delay_time);
+	motor->deadline_expired = 0;
+	timing_wheel_schedule(&motor->deadline_timer, motor->deadline, servo_deadline_expired, motor);
+}
+
+/*
+	This helper function stops a glide that is still playing and puts every TIM2
+	servo where the glide was taking it, which is where its servo data says it is
+*/
+static void glide_cut_short(){
+	trajectory_stop();
+	for(int servo_num = 0; servo_num < TRAJECTORY_FRAME_SIZE; servo_num++){
+		hal_pwm_write(servo_num, positions[glide_end[servo_num]]);
+	}
+}
+
 /*
   This funtion sets the TIM2 output correctly, then updates our data struct so we hold the correct data
 
@@ -150,28 +236,75 @@ uint16_t calculate_delay(position last_position, position new_position, int reci
 		A 16 bit unsigned integer corresponding to the total time we should delay for the move
 */
 uint16_t move_servo(int motor_num, servo_data *motor, uint16_t target_position, int recipe){
-	position last_position;
+	position last_position = motor->position;
 	position new_position = (position)target_position;
-	uint16_t current_time = get_current_time(motor_num);
+	uint32_t start_time = now();
 	uint16_t total_delay = calculate_delay(last_position, new_position, recipe);
 
-	// Move the servo first
-	if(motor_num == 0){
-		TIMER_2_MOTOR_1 = positions[new_position];
+	// Nothing moves while the emergency stop is latched, not even a move that was
+	// already on its way when the stop was hit
+	if(emergency_stop_active()){
+		return TOTAL_DELAY_DEFAULT;
 	}
-	else {
-		TIMER_2_MOTOR_2 = positions[new_position]; 
+
+	// The trajectory DMA would write over the new pulse width on the next servo period
+	if((motor_num < TRAJECTORY_FRAME_SIZE) && trajectory_active()){
+		glide_cut_short();
 	}
 
+	// Moves are not waited on, so a servo can be told to move again before it gets
+	// there.  The pulse width changes straight away, only the new move's completion
+	// deadline is chained on after the deadline of the move in progress
+	if(!motor->deadline_expired){
+		start_time = motor->deadline;
+	}
+
+	// Move the servo first, hardware and software PWM servos are driven the same way
+	hal_pwm_write(motor_num, positions[new_position]);
+
 	// Update the position data and delay appropriately
-	last_position = motor->position;
 	motor->position = new_position;
 	motor->target_position = (position)target_position;
-	motor->last_start_time = current_time;
-	motor->total_delay = total_delay;
+	schedule_servo_deadline(motor, start_time, total_delay);
 	return motor->total_delay;
 }
 
+/*
+	This function glides TIM2 servos to the far end of their travel.  Instead of
+	jumping there, the trajectory DMA plays a ramp into the CCRs one servo period at
+	a time, and the servos that are not gliding hold where they are for it
+
+	Input:
+		motors     - The array of motor struct refernces
+		glide_mask - Bit n set glides servo n
+*/
+void glide_servos(servo_data *motors, uint32_t glide_mask){
+	position start[TRAJECTORY_FRAME_SIZE];
+	uint32_t start_time = now();
+
+	if(emergency_stop_active() || (glide_mask == GLIDE_NONE)){
+		return;
+	}
+	for(int servo_num = 0; servo_num < TRAJECTORY_FRAME_SIZE; servo_num++){
+		start[servo_num] = motors[servo_num].position;
+		glide_end[servo_num] = start[servo_num];
+		if(glide_mask & (1 << servo_num)){
+			glide_end[servo_num] = (start[servo_num] < GLIDE_TURN_POSITION) ? one_hundred_and_sixty_degrees : zero_degrees;
+		}
+	}
+	trajectory_build_ramp(glide_frames, GLIDE_FRAMES, start, glide_end);
+	trajectory_start(glide_frames, GLIDE_FRAMES, TRAJECTORY_NO_LOOP);
+
+	// A gliding servo is busy until the last frame has played
+	for(int servo_num = 0; servo_num < TRAJECTORY_FRAME_SIZE; servo_num++){
+		if(glide_mask & (1 << servo_num)){
+			motors[servo_num].position = glide_end[servo_num];
+			motors[servo_num].target_position = glide_end[servo_num];
+			schedule_servo_deadline(&motors[servo_num], start_time, GLIDE_TIME);
+		}
+	}
+}
+
 /*
 	This wrapper function resets the target servo to zero degrees
 
@@ -194,9 +327,10 @@ void reset_servo(int motor_num, servo_data *motor){
 void servo_data_init(servo_data *motors){
 
 	// Loop through each servo_data
-	for(int servo_data_index; servo_data_index < NUMBER_OF_SERVOS; servo_data_index++){
+	for(int servo_data_index = 0; servo_data_index < NUMBER_OF_SERVOS; servo_data_index++){
 		motors[servo_data_index].position = zero_degrees;
 		motors[servo_data_index].recipe_index = RECIPE_INDEX_DEFAULT;
+		motors[servo_data_index].shadow_recipe_index = SHADOW_RECIPE_INDEX_DEFAULT;
 		motors[servo_data_index].recipe_instruction_index = RECIPE_INSTRUCTION_INDEX_DEFAULT;
 		motors[servo_data_index].inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
 		motors[servo_data_index].recipe_loop_count = RECIPE_LOOP_COUNT_DEFAULT;
@@ -205,6 +339,12 @@ void servo_data_init(servo_data *motors){
 		motors[servo_data_index].last_start_time = LAST_START_TIME_DEFAULT;
 		motors[servo_data_index].target_position = TARGET_POSITION_DEFAULT;
 		motors[servo_data_index].total_delay = TOTAL_DELAY_DEFAULT;
+		motors[servo_data_index].deadline = DEADLINE_DEFAULT;
+		motors[servo_data_index].deadline_expired = DEADLINE_EXPIRED_DEFAULT;
+		motors[servo_data_index].task = TASK_DEFAULT;
+		motors[servo_data_index].fault_policy = FAULT_POLICY_DEFAULT;
+		motors[servo_data_index].fault_count = FAULT_COUNT_DEFAULT;
+		motors[servo_data_index].fault_restarts = FAULT_RESTARTS_DEFAULT;
 		motors[servo_data_index].recipe_status = idle;
 	}
 }
@@ -283,6 +423,62 @@ void increment_recipe(servo_data *motor){
 	}
 }
 
+/*
+	This function loads a recipe into the servo's shadow slot.  The running recipe
+	is not touched, the shadow recipe takes over at the next RECIPE_END or loop
+	boundary so the servo never stops to change programs.  A servo that is not
+	running a recipe changes over straight away
+
+	Input:
+		index        - The motor servo data index
+		motor        - The motor struct refernce to load
+		recipe_index - The recipe to change over to
+*/
+void recipe_load_shadow(int index, servo_data *motor, int recipe_index){
+	if((recipe_index < 0) || (recipe_index >= NUMBER_OF_RECIPES)){
+		return;
+	}
+	motor->shadow_recipe_index = recipe_index;
+
+	if(motor->status == inactive){
+		recipe_swap_shadow(index, motor);
+	}
+	else {
+		usart_write_data_string("Servo %d will change over to recipe %d at its next loop or recipe end", index, recipe_index);
+	}
+}
+
+/*
+	This function changes the servo over to the recipe in its shadow slot, starting
+	it at its first instruction from wherever the servo is now
+
+	Input:
+		index - The motor servo data index
+		motor - The motor struct refernce to change over
+
+	Output:
+		SUCCESS if the servo changed over, FAILURE if the shadow slot was empty
+*/
+int recipe_swap_shadow(int index, servo_data *motor){
+	int recipe_index = motor->shadow_recipe_index;
+
+	if(recipe_index == NO_RECIPE){
+		return FAILURE;
+	}
+	usart_write_data_string("Servo %d changed over from recipe %d to recipe %d", index, motor->recipe_index, recipe_index);
+	motor->recipe_index = recipe_index;
+	motor->shadow_recipe_index = NO_RECIPE;
+
+	// Start the new recipe from the top, the servo stays where it is
+	motor->recipe_instruction_index = RECIPE_INSTRUCTION_INDEX_DEFAULT;
+	motor->recipe_loop_count = RECIPE_LOOP_COUNT_DEFAULT;
+	motor->recipe_loop_index = RECIPE_LOOP_INDEX_DEFAULT;
+	motor->inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
+	motor->recipe_status = idle;
+	motor->fault_restarts = FAULT_RESTARTS_DEFAULT;
+	return SUCCESS;
+}
+
 /*
 	Fixup the servo data on the given servo
 
@@ -303,8 +499,10 @@ void fixup_servo_data(int index, servo_data *motor, int restart){
 	}
 	else {
 
-		// If we are resetting, make sure we go back to the first recipe
+		// If we are resetting, make sure we go back to the first recipe, and forget
+		// any recipe that was waiting to take over
 		motor->recipe_index = RECIPE_INDEX_DEFAULT;
+		motor->shadow_recipe_index = SHADOW_RECIPE_INDEX_DEFAULT;
 	}
 	
 	// Reset the servo position back to 0 degrees so the next recipe starts in a known position
@@ -319,40 +517,16 @@ void fixup_servo_data(int index, servo_data *motor, int restart){
 	motor->inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
 	motor->target_position = TARGET_POSITION_DEFAULT;
 	motor->total_delay = TOTAL_DELAY_DEFAULT;
+	motor->fault_restarts = FAULT_RESTARTS_DEFAULT;
 	motor->recipe_status = idle;
 }
 
 /*
-	Fixup the servo data if need be on all servos
-
-	Input:
-		motors  - The array of motor struct refernces to update
-		restart - A flag to tell this function if we are executing from a recipe or from entering 'b' 
-*/
-void fixup_servo_data_multiple(servo_data *motors, int restart){
-
-	// Loop through each servo_data
-	for(int servo_data_index; servo_data_index < NUMBER_OF_SERVOS; servo_data_index++){
-		if((motors[servo_data_index].status == active) || restart){
-			fixup_servo_data(servo_data_index, &motors[servo_data_index], restart);
-		}
-	}
-}
-
-/*
-	This helper function determines if a servo is ready to move yet
+	This helper function determines if a servo is ready to move yet.  The timing
+	wheel flags the servo when its deadline passes, so this is just a flag check
 */
 int servo_ready(int servo_num, servo_data *motors){
-	uint16_t current_time = get_current_time(servo_num);
-	uint16_t last_start_time = motors[servo_num].last_start_time;
-	uint16_t total_delay = motors[servo_num].total_delay;
-
-	//usart_write_data_string("Total delay: %lu", total_delay);
-	//usart_write_data_string("Current_time: %lu", current_time);
-	//usart_write_data_string("Last start time: %lu", last_start_time);
-	
-	// Figure out if the servo is ready to move yet
-	if(abs(current_time - last_start_time) > total_delay){
+	if(motors[servo_num].deadline_expired){
 		return SUCCESS;
 	}
 	else {
@@ -361,47 +535,38 @@ int servo_ready(int servo_num, servo_data *motors){
 }
 
 /*
-	Helper function to determine if any servo is inactive
+	Helper function to determine if any servo is still running a recipe
 
 	Input:
 		motors  - The array of motor struct refernces to check
 
 	Output:
-		This returns 1 if at least 1 servo is inactive, 0 otherwise
+		This returns 1 if at least 1 servo is active, 0 otherwise
 */
-int some_servo_inactive(servo_data *motors){
-	int servo_inactive = 0;
+int any_servo_active(servo_data *motors){
 	for(int servo_num = 0; servo_num < NUMBER_OF_SERVOS; servo_num++){
-		if(motors[servo_num].status == inactive){
-			servo_inactive = 1;
-			break;
+		if(motors[servo_num].status == active){
+			return SUCCESS;
 		}
 	}
-	return servo_inactive;
+	return FAILURE;
 }
 
 /*
-	Helper function to determine if both servos are inactive or paused
+	Helper function to determine if a servo is in use.  The TIM2 servos always are,
+	a software PWM servo only once it has left zero degrees, run a recipe or faulted
 
 	Input:
-		motors  - The array of motor struct refernces to check
+		servo_num - The servo to check
+		motors    - The array of motor struct refernces to check
 
 	Output:
-		This returns 1 if both servos are inactive or paused
+		This returns 1 if the servo is in use, 0 otherwise
 */
-int both_servos_inactive_or_paused(servo_data *motors){
-	int stop = 0;
-	for(int servo_num = 0; servo_num < NUMBER_OF_SERVOS; servo_num++){
-			if((motors[servo_num].status == inactive) || (motors[servo_num].status == paused)){
-				stop += 1;
-			}
-	}
-
-	// Now check if both servos are inactive
-	if(stop == 2){
+int servo_in_use(int servo_num, servo_data *motors){
+	if((servo_num < NUMBER_OF_HARDWARE_SERVOS) || (motors[servo_num].status != inactive) ||
+		(motors[servo_num].position != zero_degrees) || (motors[servo_num].fault_count > 0)){
 		return SUCCESS;
 	}
-	else {
-		return FAILURE;
-	}
+	return FAILURE;
 }
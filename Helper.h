@@ -7,33 +7,40 @@
 #include <string.h>
 
 /*
-  Check the input string and see if we have a valid character in it.
-  Used to check the user input
+	Helper function that returns the name of a fault policy for printing
 
-  Input: input - The string to check if it is in valid characters
-         valid_characters - A string of valid characters input should
-                            be checked against
-  Output: An integer for success (1) if the input string contained any 
-          valid characters or failure (0) if it didn't
+	Input:
+		policy - The fault policy
+
+	Output:
+		The name of the policy
 */
-int check_for_valid_input(char *input, char *valid_characters);
+char *fault_policy_name(fault_policy policy);
 
 /*
-	Helper function to check if the user wishes to continue
+	This function moves a servo on to its next fault policy and lets the user know
+	which one it is using now
 
-	Output:
-		An integer indicating that the user wishes to continue
+	Input:
+		index - The motor servo data index
+		motor - The motor struct refernce to update
 */
-int check_for_continuation(void);
+void cycle_fault_policy(int index, servo_data *motor);
 
 /*
-  Helper function to keep the board form doing anythiung else until
-  reset is pushed, unless the user wishes to continue
+	This function handles a bad recipe instruction on one servo using that servo's
+	fault policy, without asking the user anything.  The other servos never notice,
+	and the fault is logged with a single line on the buffered console output
+
+	Input:
+		index - The motor servo data index
+		motor - The motor struct refernce of the servo that hit the fault
 
 	Output:
-		An integer indicating that the user wishes to continue
+		1 if the caller should skip the bad instruction, 0 if the policy already
+		took care of the servo
 */
-int exit_program(void);
+int handle_recipe_fault(int index, servo_data *motor);
 
 /*
   Helper function to print the banner for the program
@@ -41,7 +48,8 @@ int exit_program(void);
 void print_banner(void);
 
 /*
-	Helper function to delay a certain number of milliseconds
+	Helper function to delay a certain number of milliseconds, yielding (or
+	sleeping) until the delay service says the time is up
 */
 void delay(uint32_t delay_time);
 
@@ -59,6 +67,17 @@ void delay(uint32_t delay_time);
 */
 uint16_t calculate_delay(position last_position, position new_position, int recipe);
 
+/*
+	This function starts a servo delay on the shared timebase and registers the
+	deadline with the timing wheel
+
+	Input:
+		motor      - The motor struct refernce to update
+		start_time - The time on the shared timebase the delay starts at
+		delay_time - The number of milliseconds until the servo is ready again
+*/
+void schedule_servo_deadline(servo_data *motor, uint32_t start_time, uint16_t delay_time);
+
 /*
   This funtion sets the TIM2 output correctly, then updates our data struct so we hold the correct data
 
@@ -73,6 +92,17 @@ uint16_t calculate_delay(position last_position, position new_position, int reci
 */
 uint16_t move_servo(int motor_num, servo_data *motor, uint16_t target_position, int recipe);
 
+/*
+	This function glides TIM2 servos to the far end of their travel.  Instead of
+	jumping there, the trajectory DMA plays a ramp into the CCRs one servo period at
+	a time, and the servos that are not gliding hold where they are for it
+
+	Input:
+		motors     - The array of motor struct refernces
+		glide_mask - Bit n set glides servo n
+*/
+void glide_servos(servo_data *motors, uint32_t glide_mask);
+
 /*
 	This wrapper function resets the target servo to zero degrees
 
@@ -144,47 +174,67 @@ int instruction_in_bounds(current_instruction instruction);
 void increment_recipe(servo_data *motor);
 
 /*
-	Fixup the servo data on the given servo
+	This function loads a recipe into the servo's shadow slot.  The running recipe
+	is not touched, the shadow recipe takes over at the next RECIPE_END or loop
+	boundary so the servo never stops to change programs.  A servo that is not
+	running a recipe changes over straight away
 
 	Input:
-		index   - The motor servo data index
-		motors  - The array of motor struct refernces to update
-		restart - A flag to tell this function if we are executing from a recipe or from entering 'b' 
+		index        - The motor servo data index
+		motor        - The motor struct refernce to load
+		recipe_index - The recipe to change over to
 */
-void fixup_servo_data(int index, servo_data *motor, int restart);
+void recipe_load_shadow(int index, servo_data *motor, int recipe_index);
 
 /*
-	Fixup the servo data if need be on all servos
+	This function changes the servo over to the recipe in its shadow slot, starting
+	it at its first instruction from wherever the servo is now
 
 	Input:
+		index - The motor servo data index
+		motor - The motor struct refernce to change over
+
+	Output:
+		SUCCESS if the servo changed over, FAILURE if the shadow slot was empty
+*/
+int recipe_swap_shadow(int index, servo_data *motor);
+
+/*
+	Fixup the servo data on the given servo
+
+	Input:
+		index   - The motor servo data index
 		motors  - The array of motor struct refernces to update
 		restart - A flag to tell this function if we are executing from a recipe or from entering 'b' 
 */
-void fixup_servo_data_multiple(servo_data *motors, int restart);
+void fixup_servo_data(int index, servo_data *motor, int restart);
 
 /*
-	This helper function determines if a servo is ready to move yet
+	This helper function determines if a servo is ready to move yet.  The timing
+	wheel flags the servo when its deadline passes, so this is just a flag check
 */
 int servo_ready(int servo_num, servo_data *motors);
 
 /*
-	Helper function to determine if any servo is inactive
+	Helper function to determine if any servo is still running a recipe
 
 	Input:
 		motors  - The array of motor struct refernces to check
 
 	Output:
-		This returns 1 if at least 1 servo is inactive, 0 otherwise
+		This returns 1 if at least 1 servo is active, 0 otherwise
 */
-int some_servo_inactive(servo_data *motors);
+int any_servo_active(servo_data *motors);
 
 /*
-	Helper function to determine if both servos are inactive or paused
+	Helper function to determine if a servo is in use.  The TIM2 servos always are,
+	a software PWM servo only once it has left zero degrees, run a recipe or faulted
 
 	Input:
-		motors  - The array of motor struct refernces to check
+		servo_num - The servo to check
+		motors    - The array of motor struct refernces to check
 
 	Output:
-		This returns 1 if both servos are inactive or paused
+		This returns 1 if the servo is in use, 0 otherwise
 */
-int both_servos_inactive_or_paused(servo_data *motors);
+int servo_in_use(int servo_num, servo_data *motors);
@@ -0,0 +1,182 @@
+/*
+  The line editor file turns typed bytes into command lines.  It is fed one byte at
+  a time as the bytes arrive and keeps everything it needs in a line_editor struct,
+  so it never waits for the next key and nothing else stalls while the user types.
+  A line can hold many command sets, like "RN,3LR;CC", which are split back out
+  one at a time for the dispatcher
+*/
+
+#include "LINE_EDITOR.h"
+#include "Helper.h"
+
+/*
+	This function empties the line so the next command line can be typed in
+
+	Input:
+		editor - The line editor to reset
+*/
+void line_editor_reset(line_editor *editor){
+	for(int index = 0; index <= COMMAND_LINE_SIZE; index++){
+		editor->buffer[index] = '\0';
+	}
+	editor->length = 0;
+}
+
+/*
+	This function handles one typed byte.  The byte is echoed back so the user can
+	see what they are typing, backspace moves the cursor back, and X or x throws the
+	line away
+
+	Input:
+		editor - The line editor to feed
+		input  - The byte that was typed
+
+	Output:
+		LINE_EDITOR_DONE once editor->buffer holds a whole command line,
+		LINE_EDITOR_CANCELLED if the line was thrown away, LINE_EDITOR_BUSY otherwise
+*/
+int line_editor_feed(line_editor *editor, char input){
+	uint16_t flags = command_table[(uint8_t)input].flags;
+
+	if(flags & COMMAND_FLAG_NEWLINE){
+		return LINE_EDITOR_DONE;
+	}
+
+	// Check if the user entered an X, if they did, then we have to write that
+	// out and start the line over
+	if(flags & COMMAND_FLAG_CANCEL){
+		usart_real_time_write(input, PRINT_NEWLINE);
+		usart_terminal_character_simple();
+		line_editor_reset(editor);
+		return LINE_EDITOR_CANCELLED;
+	}
+
+	// Next handle when the user enters a backspace, only go back as far as the start of the line
+	if(flags & COMMAND_FLAG_BACKSPACE){
+		if(editor->length > 0){
+			editor->length--;
+			editor->buffer[editor->length] = '\0';
+
+			// Write out the backspace
+			usart_real_time_write(input, NO_NEWLINE);
+		}
+		return LINE_EDITOR_BUSY;
+	}
+
+	// A key past the end of the buffer finishes the line the same as enter
+	if(editor->length >= COMMAND_LINE_SIZE){
+		return LINE_EDITOR_DONE;
+	}
+
+	// Store our character and write it out
+	editor->buffer[editor->length] = input;
+	editor->length++;
+	usart_real_time_write(input, NO_NEWLINE);
+	return LINE_EDITOR_BUSY;
+}
+
+/*
+	This helper function reads the number at the start of a command set, a repeat
+	count or a servo number.  Anything past MAX_COMMAND_REPEAT is cut down to it,
+	which is still past the last servo
+
+	Input:
+		line   - Where the number starts, moved past it
+		number - Filled with the number
+
+	Output:
+		SUCCESS if there was a number, FAILURE otherwise
+*/
+static int command_line_number(char **line, int *number){
+	int given = 0;
+
+	*number = 0;
+	while(command_table[(uint8_t)**line].flags & COMMAND_FLAG_DIGIT){
+		*number = (*number * 10) + (**line - '0');
+		if(*number > MAX_COMMAND_REPEAT){
+			*number = MAX_COMMAND_REPEAT;
+		}
+		given = 1;
+		(*line)++;
+	}
+	return given;
+}
+
+/*
+	This function pulls the next command set out of a command line.  Command sets
+	are split up by any of the COMMAND_FLAG_DELIMITER bytes, and can start with a repeat count,
+	so "RN,3LN" is RN once and then LN three times.  A servo number and ':' in front
+	start the letters at that servo, so "5:3L" turns servo 5 left three times.  The
+	servos before it get 'N', and the ones after the last letter are left alone
+
+	Input:
+		cursor      - Where to start looking in the line, moved past the command set
+		command_set - Filled with the letters of the command set, NULL terminated
+		repeat      - Filled with the number of times to run the command set
+
+	Output:
+		SUCCESS if a command set was found, FAILURE once the line is used up
+*/
+int command_line_next(char **cursor, char command_set[COMMAND_BUFFER_SIZE + 1], int *repeat){
+	char *line = *cursor;
+	int length = 0;
+	int count;
+	int count_given;
+	int first_servo = FIRST_SERVO_DEFAULT;
+
+	// Skip over the delimiters before the command set
+	while(command_table[(uint8_t)*line].flags & COMMAND_FLAG_DELIMITER){
+		line++;
+	}
+	if(*line == '\0'){
+		*cursor = line;
+		return FAILURE;
+	}
+
+	// The servo number comes first if there is one, then the repeat count
+	count_given = command_line_number(&line, &count);
+	if(command_table[(uint8_t)*line].flags & COMMAND_FLAG_FIRST_SERVO){
+		first_servo = count_given ? count : NUMBER_OF_SERVOS;
+		line++;
+		count_given = command_line_number(&line, &count);
+	}
+	*repeat = count_given ? count : COMMAND_REPEAT_DEFAULT;
+
+	// Then one letter per servo up to the next delimiter
+	for(int index = 0; index <= COMMAND_BUFFER_SIZE; index++){
+		command_set[index] = '\0';
+	}
+	while((*line != '\0') && !(command_table[(uint8_t)*line].flags & COMMAND_FLAG_DELIMITER)){
+		if((first_servo + length) < COMMAND_BUFFER_SIZE){
+			command_set[first_servo + length] = *line;
+		}
+		length++;
+		line++;
+	}
+	*cursor = line;
+
+	// A count with no letters is just an invalid set, only complain about it once
+	if(length == 0){
+		*repeat = COMMAND_REPEAT_DEFAULT;
+	}
+
+	// Don't guess at what a set past the last servo or with too many letters meant
+	else if(first_servo >= NUMBER_OF_SERVOS){
+		usart_write_simple("");
+		usart_write_data_string("There is no servo %d, the servos are 0 to %d, skipping the command set", first_servo, NUMBER_OF_SERVOS - 1);
+		*repeat = 0;
+	}
+	else if((first_servo + length) > COMMAND_BUFFER_SIZE){
+		usart_write_simple("");
+		usart_write_data_string("Command set starting '%s' has too many letters, skipping it", &command_set[first_servo]);
+		*repeat = 0;
+	}
+
+	// Every servo before the first one the letters are for does nothing
+	else {
+		for(int index = 0; index < first_servo; index++){
+			command_set[index] = 'N';
+		}
+	}
+	return SUCCESS;
+}
@@ -0,0 +1,46 @@
+/*
+  Function declarations for the byte at a time command line editor
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function empties the line so the next command line can be typed in
+
+	Input:
+		editor - The line editor to reset
+*/
+void line_editor_reset(line_editor *editor);
+
+/*
+	This function handles one typed byte.  The byte is echoed back so the user can
+	see what they are typing, backspace moves the cursor back, and X or x throws the
+	line away
+
+	Input:
+		editor - The line editor to feed
+		input  - The byte that was typed
+
+	Output:
+		LINE_EDITOR_DONE once editor->buffer holds a whole command line,
+		LINE_EDITOR_CANCELLED if the line was thrown away, LINE_EDITOR_BUSY otherwise
+*/
+int line_editor_feed(line_editor *editor, char input);
+
+/*
+	This function pulls the next command set out of a command line.  Command sets
+	are split up by any of the COMMAND_FLAG_DELIMITER bytes, and can start with a repeat count,
+	so "RN,3LN" is RN once and then LN three times.  A servo number and ':' in front
+	start the letters at that servo, so "5:3L" turns servo 5 left three times.  The
+	servos before it get 'N', and the ones after the last letter are left alone
+
+	Input:
+		cursor      - Where to start looking in the line, moved past the command set
+		command_set - Filled with the letters of the command set, NULL terminated
+		repeat      - Filled with the number of times to run the command set
+
+	Output:
+		SUCCESS if a command set was found, FAILURE once the line is used up
+*/
+int command_line_next(char **cursor, char command_set[COMMAND_BUFFER_SIZE + 1], int *repeat);
@@ -0,0 +1,63 @@
+/*
+  The power file holds the idle path every wait in the program goes through.  Instead
+  of spinning, the core sleeps until an interrupt has something for it to do.  Sleep
+  mode is used rather than Stop 2, since Stop 2 turns off the APB clocks and would
+  stop the TIM2 PWM holding the servos in place
+*/
+
+#include "POWER.h"
+#include "TIMER.h"
+
+// The idle measurement window on the shared timebase
+static INSTANCE uint32_t idle_window_start;
+static INSTANCE uint32_t idle_window_time;
+
+/*
+	This function picks the sleep mode used when idle and clears the idle statistics
+*/
+void idle_init(){
+
+	// Plain sleep keeps every peripheral clock running, so PWM, DMA and the UART keep going
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+	idle_reset_statistics();
+}
+
+/*
+	This function sleeps until the next interrupt (a timing wheel deadline, a UART
+	byte, a DMA refill) and adds the time spent asleep to the idle statistics.
+
+	Call it with interrupts disabled, after checking there is nothing to do.  A
+	pending interrupt still wakes the core, and it runs once the caller enables
+	interrupts again, so a wakeup can never be missed between the check and the sleep
+*/
+void idle_enter(){
+	uint32_t sleep_start = now();
+
+	__DSB();
+	__WFI();
+	idle_window_time += now() - sleep_start;
+}
+
+/*
+	Helper function to report how much of the time since the statistics were last
+	cleared was spent asleep
+
+	Output:
+		The percentage of time spent idle (0 - 100)
+*/
+int idle_percentage(){
+	uint32_t window_length = now() - idle_window_start;
+
+	if(window_length == 0){
+		return 0;
+	}
+	return (int)(((uint64_t)idle_window_time * IDLE_PERCENT) / window_length);
+}
+
+/*
+	This function starts a new idle measurement window
+*/
+void idle_reset_statistics(){
+	idle_window_start = now();
+	idle_window_time = 0;
+}
@@ -0,0 +1,35 @@
+/*
+  Function declarations for the low power idle path
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function picks the sleep mode used when idle and clears the idle statistics
+*/
+void idle_init(void);
+
+/*
+	This function sleeps until the next interrupt (a timing wheel deadline, a UART
+	byte, a DMA refill) and adds the time spent asleep to the idle statistics.
+
+	Call it with interrupts disabled, after checking there is nothing to do.  A
+	pending interrupt still wakes the core, and it runs once the caller enables
+	interrupts again, so a wakeup can never be missed between the check and the sleep
+*/
+void idle_enter(void);
+
+/*
+	Helper function to report how much of the time since the statistics were last
+	cleared was spent asleep
+
+	Output:
+		The percentage of time spent idle (0 - 100)
+*/
+int idle_percentage(void);
+
+/*
+	This function starts a new idle measurement window
+*/
+void idle_reset_statistics(void);
@@ -0,0 +1,122 @@
+/*
+  The recipe trace file keeps a ring of every recipe instruction the servos start:
+  the servo, the recipe, where in it, the instruction byte and the time.  An entry is
+  a fixed 8 bytes, so recording one is a few stores.  The ring lives in retained
+  memory that nothing clears at reset, so after a warm reset (a watchdog or the
+  reset button) the last instructions before it are still there to print.  The D
+  command prints the ring and a recipe fault prints its last few entries
+*/
+
+#include "RECIPE_TRACE.h"
+#include "HAL.h"
+#include "Helper.h"
+
+// The ring, in retained memory
+static INSTANCE recipe_trace_buffer *recipe_trace;
+
+// Cleared while the benchmarks borrow the interpreter
+static INSTANCE int recipe_trace_enabled = RECIPE_TRACE_ON;
+
+/*
+	Helper function that names an opcode for printing
+
+	Input:
+		opcode - The opcode bits of an instruction
+
+	Output:
+		The name of the opcode
+*/
+static char *recipe_trace_opcode_name(uint8_t opcode){
+	switch(opcode){
+		case MOV:
+			return "MOV";
+		case WAIT:
+			return "WAIT";
+		case LOOP:
+			return "LOOP";
+		case END_LOOP:
+			return "END_LOOP";
+		case RECIPE_END:
+			return "RECIPE_END";
+		default:
+			return "invalid";
+	}
+}
+
+/*
+	This function finds the ring in retained memory.  A ring left from before a warm
+	reset is kept, anything else is cleared
+
+	Output:
+		The number of entries kept from before the reset, 0 after a power up
+*/
+uint32_t recipe_trace_init(){
+	recipe_trace = (recipe_trace_buffer *)hal_retained_memory();
+
+	if(recipe_trace->magic != RECIPE_TRACE_MAGIC){
+		memset(recipe_trace, 0, sizeof(recipe_trace_buffer));
+		recipe_trace->magic = RECIPE_TRACE_MAGIC;
+		return 0;
+	}
+	recipe_trace->resets++;
+	return (recipe_trace->written < RECIPE_TRACE_SIZE) ? recipe_trace->written : RECIPE_TRACE_SIZE;
+}
+
+/*
+	This function records one recipe instruction as it starts
+
+	Input:
+		servo       - The servo running it
+		recipe      - The recipe it is in
+		index       - Where it is in the recipe
+		instruction - The instruction byte
+*/
+void recipe_trace_record(int servo, int recipe, int index, uint8_t instruction){
+	recipe_trace_entry *entry = &recipe_trace->entries[recipe_trace->written & RECIPE_TRACE_MASK];
+
+	if(!recipe_trace_enabled){
+		return;
+	}
+	entry->time = hal_timebase_now();
+	entry->servo = servo;
+	entry->recipe = recipe;
+	entry->index = index;
+	entry->instruction = instruction;
+	recipe_trace->written++;
+}
+
+/*
+	This function turns the recording on or off, so something that only runs the
+	interpreter to time it does not fill the ring
+
+	Input:
+		enable - RECIPE_TRACE_ON or RECIPE_TRACE_OFF
+*/
+void recipe_trace_enable(int enable){
+	recipe_trace_enabled = enable;
+}
+
+/*
+	This function prints the newest entries of the ring, oldest first
+
+	Input:
+		count - How many entries to print at most, RECIPE_TRACE_ALL for every one
+*/
+void recipe_trace_print(uint32_t count){
+	uint32_t written = recipe_trace->written;
+	recipe_trace_entry *entry;
+
+	if(count > RECIPE_TRACE_SIZE){
+		count = RECIPE_TRACE_SIZE;
+	}
+	if(count > written){
+		count = written;
+	}
+	usart_write_data_string("Recipe trace, the last %u of %u instructions, kept over %u resets:", count, written, recipe_trace->resets);
+	for(uint32_t number = written - count; number != written; number++){
+		entry = &recipe_trace->entries[number & RECIPE_TRACE_MASK];
+		usart_write_data_string("  %10u us servo %d recipe %d instruction %2d %s %d",
+			entry->time, entry->servo, entry->recipe, entry->index,
+			recipe_trace_opcode_name(get_opcode(entry->instruction)), get_parameter(entry->instruction));
+	}
+}
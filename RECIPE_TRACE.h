@@ -0,0 +1,43 @@
+/*
+  Function declarations for the recipe trace, the ring of every recipe instruction run
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function finds the ring in retained memory.  A ring left from before a warm
+	reset is kept, anything else is cleared
+
+	Output:
+		The number of entries kept from before the reset, 0 after a power up
+*/
+uint32_t recipe_trace_init(void);
+
+/*
+	This function records one recipe instruction as it starts
+
+	Input:
+		servo       - The servo running it
+		recipe      - The recipe it is in
+		index       - Where it is in the recipe
+		instruction - The instruction byte
+*/
+void recipe_trace_record(int servo, int recipe, int index, uint8_t instruction);
+
+/*
+	This function turns the recording on or off, so something that only runs the
+	interpreter to time it does not fill the ring
+
+	Input:
+		enable - RECIPE_TRACE_ON or RECIPE_TRACE_OFF
+*/
+void recipe_trace_enable(int enable);
+
+/*
+	This function prints the newest entries of the ring, oldest first
+
+	Input:
+		count - How many entries to print at most, RECIPE_TRACE_ALL for every one
+*/
+void recipe_trace_print(uint32_t count);
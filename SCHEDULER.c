@@ -0,0 +1,149 @@
+/*
+  The scheduler file runs every part of the program (UART output, the recipe
+  interpreters, the console and telemetry) as a run to completion task.  Interrupts
+  and timing wheel callbacks set event flags on a task, and the highest priority task
+  with events waiting runs next.  A task's number is its priority, so picking the
+  next task is a single count of trailing zeros on the ready mask
+*/
+
+#include "SCHEDULER.h"
+#include "POWER.h"
+#include "DELAY.h"
+
+// Every task, indexed by task number
+static INSTANCE task tasks[MAX_TASKS];
+
+// One bit per task with events waiting, set from interrupts
+static INSTANCE volatile uint32_t tasks_ready;
+
+// One bit per task that is running right now.  A task that waits lets other tasks
+// run inside the wait, but it is never run inside itself
+static INSTANCE uint32_t tasks_running;
+
+/*
+	This function clears out the task table
+*/
+void scheduler_init(){
+	for(int task_id = 0; task_id < MAX_TASKS; task_id++){
+		tasks[task_id].function = NULL;
+		tasks[task_id].context = NULL;
+		tasks[task_id].events = 0;
+	}
+	tasks_ready = 0;
+	tasks_running = 0;
+}
+
+/*
+	This function adds a task to the scheduler.  The task does not run until it
+	is signalled
+
+	Input:
+		task_id  - The task number, which is also its priority (0 runs first)
+		function - The function to run when the task has events waiting
+		context  - Passed to the function every time it runs
+
+	Output:
+		SUCCESS if the task was added, FAILURE if the number is taken or out of range
+*/
+int task_create(int task_id, task_function function, void *context){
+	if((task_id < 0) || (task_id >= MAX_TASKS) || (function == NULL) || (tasks[task_id].function != NULL)){
+		return FAILURE;
+	}
+	tasks[task_id].context = context;
+	tasks[task_id].function = function;
+	return SUCCESS;
+}
+
+/*
+	This function sets event flags on a task so it runs soon.  It is safe to call
+	from interrupts and from other tasks
+
+	Input:
+		task_id - The task to signal, NO_TASK does nothing
+		events  - The TASK_EVENT flags to set
+*/
+void task_signal(int task_id, uint32_t events){
+	uint32_t interrupts = __get_PRIMASK();
+
+	if((task_id < 0) || (task_id >= MAX_TASKS) || (events == 0)){
+		return;
+	}
+
+	__disable_irq();
+	tasks[task_id].events |= events;
+	tasks_ready |= (1U << task_id);
+	__set_PRIMASK(interrupts);
+}
+
+/*
+	This function runs the highest priority task that has events waiting and is
+	not already running
+
+	Output:
+		SUCCESS if a task ran, FAILURE if there was nothing to run
+*/
+int scheduler_run_one(){
+	uint32_t interrupts = __get_PRIMASK();
+	uint32_t runnable;
+	uint32_t task_bit;
+	uint32_t events;
+	uint32_t start;
+	uint32_t cycles;
+	int task_id;
+
+	// Take the events in one go, anything signalled after this runs the task again
+	__disable_irq();
+	runnable = tasks_ready & ~tasks_running;
+	if(runnable == 0){
+		__set_PRIMASK(interrupts);
+		return FAILURE;
+	}
+	task_id = __CLZ(__RBIT(runnable));
+	task_bit = (1U << task_id);
+	events = tasks[task_id].events;
+	tasks[task_id].events = 0;
+	tasks_ready &= ~task_bit;
+	__set_PRIMASK(interrupts);
+
+	// Signalling a task number nobody created just drops the events
+	if(tasks[task_id].function != NULL){
+		tasks_running |= task_bit;
+		start = cycles_now();
+		tasks[task_id].function(events, tasks[task_id].context);
+		cycles = cycles_now() - start;
+		tasks_running &= ~task_bit;
+		counters.loop_iterations++;
+		if(cycles > counters.loop_worst_cycles){
+			counters.loop_worst_cycles = cycles;
+		}
+	}
+	return SUCCESS;
+}
+
+/*
+	Helper function to tell if scheduler_run_one has anything to run
+
+	Output:
+		1 if a task that is not already running has events waiting, 0 otherwise
+*/
+int scheduler_work_pending(){
+	return ((tasks_ready & ~tasks_running) != 0);
+}
+
+/*
+	This function runs tasks forever, sleeping whenever none of them has anything
+	to do.  Waits inside a task run the other tasks instead of sleeping from here on
+*/
+void scheduler_run(){
+	delay_set_yield(scheduler_run_one, scheduler_work_pending);
+
+	while(1){
+		if(!scheduler_run_one()){
+			__disable_irq();
+			if(!scheduler_work_pending()){
+				idle_enter();
+			}
+			__enable_irq();
+		}
+	}
+}
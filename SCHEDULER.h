@@ -0,0 +1,58 @@
+/*
+  Function declarations for the cooperative run to completion task scheduler
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function clears out the task table
+*/
+void scheduler_init(void);
+
+/*
+	This function adds a task to the scheduler.  The task does not run until it
+	is signalled
+
+	Input:
+		task_id  - The task number, which is also its priority (0 runs first)
+		function - The function to run when the task has events waiting
+		context  - Passed to the function every time it runs
+
+	Output:
+		SUCCESS if the task was added, FAILURE if the number is taken or out of range
+*/
+int task_create(int task_id, task_function function, void *context);
+
+/*
+	This function sets event flags on a task so it runs soon.  It is safe to call
+	from interrupts and from other tasks
+
+	Input:
+		task_id - The task to signal, NO_TASK does nothing
+		events  - The TASK_EVENT flags to set
+*/
+void task_signal(int task_id, uint32_t events);
+
+/*
+	This function runs the highest priority task that has events waiting and is
+	not already running
+
+	Output:
+		SUCCESS if a task ran, FAILURE if there was nothing to run
+*/
+int scheduler_run_one(void);
+
+/*
+	Helper function to tell if scheduler_run_one has anything to run
+
+	Output:
+		1 if a task that is not already running has events waiting, 0 otherwise
+*/
+int scheduler_work_pending(void);
+
+/*
+	This function runs tasks forever, sleeping whenever none of them has anything
+	to do.  Waits inside a task run the other tasks instead of sleeping from here on
+*/
+void scheduler_run(void);
@@ -0,0 +1,119 @@
+/*
+  The software PWM file generates servo pulses on every pin of one GPIO port.  TIM6
+  paces DMA1 channel 3 through a table with one BSRR word per 0.1ms slot: the first
+  slot sets every enabled pin, and each channel's reset bit sits in the slot where
+  its pulse should end.  Changing a pulse only moves one bit in the table.
+
+  Only the pins of the NUMBER_OF_SOFT_PWM_SERVOS channels are touched, the rest of
+  the port (the LSE crystal on PC14 and PC15) is left alone.  Channel n is servo
+  NUMBER_OF_HARDWARE_SERVOS + n to the console and the recipes, hal_pwm_write sends
+  every servo past the TIM2 ones here
+*/
+
+#include "SOFT_PWM.h"
+
+// The table the DMA streams into BSRR, one word for each slot of the servo period
+static INSTANCE uint32_t soft_pwm_table[SOFT_PWM_SLOTS];
+
+// The pulse width of every channel, so we know which slot holds its reset bit
+static INSTANCE int soft_pwm_widths[NUMBER_OF_SOFT_PWM_SERVOS];
+
+/*
+	This function sets up the software PWM port, TIM6 and DMA1 channel 3, then
+	starts streaming the BSRR table.  Every channel starts at zero degrees
+*/
+void soft_pwm_init(){
+
+	// Every channel's pin is a push pull output, the other pins on the port keep their mode
+	GPIO_CLOCK |= SOFT_PWM_GPIO_CLOCK_ENABLE;
+	for(int channel = 0; channel < NUMBER_OF_SOFT_PWM_SERVOS; channel++){
+		SOFT_PWM_GPIO->MODER &= ~(SOFT_PWM_MODE_MASK << (channel * SOFT_PWM_MODE_BITS));
+		SOFT_PWM_GPIO->MODER |= (SOFT_PWM_MODE_OUTPUT << (channel * SOFT_PWM_MODE_BITS));
+	}
+
+	// Build the table before the DMA starts reading it
+	for(int channel = 0; channel < NUMBER_OF_SOFT_PWM_SERVOS; channel++){
+		soft_pwm_widths[channel] = SOFT_PWM_DISABLED;
+		soft_pwm_set_width(channel, positions[zero_degrees]);
+	}
+
+	// Route the TIM6 update request to DMA1 channel 3 and point it at BSRR
+	DMA_1 |= DMA_1_ENABLE;
+	DMA_1_REQUEST_SELECT &= ~SOFT_PWM_DMA_REQUEST_MASK;
+	DMA_1_REQUEST_SELECT |= SOFT_PWM_DMA_REQUEST_TIM6_UP;
+	SOFT_PWM_DMA->CCR = SOFT_PWM_DMA_CONFIGURATION;
+	SOFT_PWM_DMA->CPAR = (uint32_t)(uintptr_t)&SOFT_PWM_GPIO->BSRR;
+	SOFT_PWM_DMA->CMAR = (uint32_t)(uintptr_t)soft_pwm_table;
+	SOFT_PWM_DMA->CNDTR = SOFT_PWM_SLOTS;
+	SOFT_PWM_DMA->CCR |= DMA_CCR_EN;
+
+	// Pace the DMA with TIM6, one request per slot
+	SOFT_PWM_TIMER_CLOCK |= SOFT_PWM_TIMER_ENABLE;
+	SOFT_PWM_TIMER->PSC = SOFT_PWM_TIMER_PRESCALER;
+	SOFT_PWM_TIMER->ARR = SOFT_PWM_TIMER_RELOAD;
+	SOFT_PWM_TIMER->EGR |= TIM_EGR_UG;
+	SOFT_PWM_TIMER->DIER |= TIM_DIER_UDE;
+	SOFT_PWM_TIMER->CR1 |= TIM_CR1_CEN;
+}
+
+/*
+	This function changes the pulse width of one software PWM channel by moving
+	its reset bit in the BSRR table.  Only the two slots involved are touched
+
+	Input:
+		channel     - The software PWM channel (0 to NUMBER_OF_SOFT_PWM_SERVOS - 1)
+		pulse_width - The pulse width in 0.1ms slots, the same units as the TIM2 CCRs.
+		              SOFT_PWM_DISABLED turns the channel off, a negative width is ignored
+*/
+void soft_pwm_set_width(int channel, int pulse_width){
+	uint32_t set_bit = (1U << channel);
+	uint32_t reset_bit = (1U << (channel + SOFT_PWM_RESET_SHIFT));
+	int old_width;
+
+	// A negative width has no slot in the table
+	if((channel < 0) || (channel >= NUMBER_OF_SOFT_PWM_SERVOS) || (pulse_width < 0)){
+		return;
+	}
+
+	// The pulse has to end before the next period starts
+	if(pulse_width >= SOFT_PWM_SLOTS){
+		pulse_width = SOFT_PWM_SLOTS - 1;
+	}
+	old_width = soft_pwm_widths[channel];
+
+	if(pulse_width == SOFT_PWM_DISABLED){
+
+		// Stop raising the pin first, the old reset bit drops it if the DMA is mid pulse
+		soft_pwm_table[SOFT_PWM_PERIOD_START] &= ~set_bit;
+		if(old_width != SOFT_PWM_DISABLED){
+			soft_pwm_table[old_width] &= ~reset_bit;
+		}
+	}
+	else {
+
+		// Add the new reset bit before removing the old one, so the DMA can at worst
+		// cut one pulse short but never leave the pin high for a whole period
+		soft_pwm_table[pulse_width] |= reset_bit;
+		if((old_width != SOFT_PWM_DISABLED) && (old_width != pulse_width)){
+			soft_pwm_table[old_width] &= ~reset_bit;
+		}
+		soft_pwm_table[SOFT_PWM_PERIOD_START] |= set_bit;
+	}
+	soft_pwm_widths[channel] = pulse_width;
+}
+
+/*
+	Helper function to read back the pulse width of a software PWM channel
+
+	Input:
+		channel - The software PWM channel (0 to NUMBER_OF_SOFT_PWM_SERVOS - 1)
+
+	Output:
+		The pulse width in 0.1ms slots, SOFT_PWM_DISABLED if the channel is off
+*/
+int soft_pwm_get_width(int channel){
+	if((channel < 0) || (channel >= NUMBER_OF_SOFT_PWM_SERVOS)){
+		return SOFT_PWM_DISABLED;
+	}
+	return soft_pwm_widths[channel];
+}
@@ -0,0 +1,34 @@
+/*
+  Function declarations for the DMA to GPIO software PWM
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function sets up the software PWM port, TIM6 and DMA1 channel 3, then
+	starts streaming the BSRR table.  Every channel starts at zero degrees
+*/
+void soft_pwm_init(void);
+
+/*
+	This function changes the pulse width of one software PWM channel by moving
+	its reset bit in the BSRR table.  Only the two slots involved are touched
+
+	Input:
+		channel     - The software PWM channel (0 to NUMBER_OF_SOFT_PWM_SERVOS - 1)
+		pulse_width - The pulse width in 0.1ms slots, the same units as the TIM2 CCRs.
+		              SOFT_PWM_DISABLED turns the channel off, a negative width is ignored
+*/
+void soft_pwm_set_width(int channel, int pulse_width);
+
+/*
+	Helper function to read back the pulse width of a software PWM channel
+
+	Input:
+		channel - The software PWM channel (0 to NUMBER_OF_SOFT_PWM_SERVOS - 1)
+
+	Output:
+		The pulse width in 0.1ms slots, SOFT_PWM_DISABLED if the channel is off
+*/
+int soft_pwm_get_width(int channel);
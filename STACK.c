@@ -0,0 +1,88 @@
+/*
+  The stack file measures how much of the stack the program really uses.  The
+  startup code paints the whole stack with STACK_PAINT at reset, and every word that
+  no longer holds the paint has been written since, so the deepest such word is the
+  high water mark.  To see what one call path uses, the free part below the caller
+  is painted again, the path runs, and the paint it wiped out is its depth
+*/
+
+#include "STACK.h"
+#include "HAL.h"
+
+// The deepest the stack has been, kept over repaints that wipe out the evidence
+static INSTANCE uint32_t stack_deepest;
+
+/*
+	Helper function that finds the lowest stack word that lost its paint
+
+	Output:
+		The lowest used word, the top of the stack if none was
+*/
+static uint32_t *stack_lowest_used(){
+	uint32_t *word = hal_stack_bottom();
+	uint32_t *top = hal_stack_top();
+
+	while((word < top) && (*word == STACK_PAINT)){
+		word++;
+	}
+	return word;
+}
+
+/*
+	This function finds the most stack the program has used since reset
+
+	Output:
+		The deepest the stack has been, in bytes
+*/
+uint32_t stack_high_water(){
+	uint32_t used = (uint32_t)(hal_stack_top() - stack_lowest_used()) * sizeof(uint32_t);
+
+	if(used > stack_deepest){
+		stack_deepest = used;
+	}
+	return stack_deepest;
+}
+
+/*
+	Helper function that gives the size of the stack
+
+	Output:
+		The stack's size in bytes
+*/
+uint32_t stack_size(){
+	return (uint32_t)(hal_stack_top() - hal_stack_bottom()) * sizeof(uint32_t);
+}
+
+/*
+	This function paints the free part of the stack again, so the next stack_depth
+	only sees what ran after it.  The high water mark so far is kept first
+*/
+void stack_paint(){
+	uint32_t *word = hal_stack_bottom();
+	uint32_t *end = hal_stack_pointer() - STACK_PAINT_MARGIN;
+
+	stack_high_water();
+
+	// An interrupt only uses the stack below the one it interrupted and is done with
+	// it by the time it returns, so painting under it does no harm
+	while(word < end){
+		*word = STACK_PAINT;
+		word++;
+	}
+}
+
+/*
+	This function measures how far below a point the stack has grown since the last
+	stack_paint
+
+	Input:
+		from - The stack pointer the measurement is taken from
+
+	Output:
+		The bytes used below it
+*/
+uint32_t stack_depth(uint32_t *from){
+	uint32_t *lowest = stack_lowest_used();
+
+	return (lowest < from) ? (uint32_t)(from - lowest) * sizeof(uint32_t) : 0;
+}
@@ -0,0 +1,40 @@
+/*
+  Function declarations for the stack high water mark
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function finds the most stack the program has used since reset
+
+	Output:
+		The deepest the stack has been, in bytes
+*/
+uint32_t stack_high_water(void);
+
+/*
+	Helper function that gives the size of the stack
+
+	Output:
+		The stack's size in bytes
+*/
+uint32_t stack_size(void);
+
+/*
+	This function paints the free part of the stack again, so the next stack_depth
+	only sees what ran after it.  The high water mark so far is kept first
+*/
+void stack_paint(void);
+
+/*
+	This function measures how far below a point the stack has grown since the last
+	stack_paint
+
+	Input:
+		from - The stack pointer the measurement is taken from
+
+	Output:
+		The bytes used below it
+*/
+uint32_t stack_depth(uint32_t *from);
@@ -1,8 +1,10 @@
 /*
   The timer file is used to encapsulate the functions that relate to using the TIM2 register
+  and the TIM5 timebase every servo shares
 */
 
 #include "TIMER.h"
+#include "HAL.h"
 
 // Define our positions here so they propegate up to main.c
 int positions[END_OF_POSITION_ARRAY] = {
@@ -42,105 +44,69 @@ void timer_init(){
 }
 
 /*
-  Helper function to take care of initializing the timer registers
-	for timing the servos.  Loads the prescaler value (forces the load),
-	then enables capture input
+	This function starts TIM5 counting freely in microseconds.  Every servo shares
+	this one clock, so TIM3 and TIM4 are no longer needed for timing moves
 */
-void servo_timers_init(){
-
-  // Enable the TIM3 clock
-  TIMER_3 |= TIMER_3_ENABLE;
-  TIMER_4 |= TIMER_4_ENABLE;
-
-  // Adjust the TIM3 device
-  TIMER_3_PRESCALER          = TIMER_3_4_PRESCLAER_RATIO;      // Load a prescale value to make the TIM3 clock rate match the GPIO clock rate
-  TIMER_3_PRESCALER_ENABLE   |= TIMER_3_PRESCALER_FORCE_LOAD;  // Force the board to load the prescaler value and match the clock rates
-  TIMER_3_CAPTURE_INPUT      &= CLEAR;                         // Clear the input register
-  TIMER_3_CAPTURE_COMPARE    |= TIMER_3_CAPTURE_SET_TO_INPUT;  // Make sure the capture channel is set to input mode
-  TIMER_3_CAPTURE_INPUT      |= TIMER_3_ENABLE_INPUT_CAPTURE;   // Enable capturing data on TIM3
-
-  // Adjust the TIM4 device
-  TIMER_4_PRESCALER          = TIMER_3_4_PRESCLAER_RATIO;      // Load a prescale value to make the TIM4 clock rate match the GPIO clock rate
-  TIMER_4_PRESCALER_ENABLE   |= TIMER_4_PRESCALER_FORCE_LOAD;  // Force the board to load the prescaler value and match the clock rates
-  TIMER_4_CAPTURE_INPUT      &= CLEAR;                         // Clear the input register
-  TIMER_4_CAPTURE_COMPARE    |= TIMER_4_CAPTURE_SET_TO_INPUT;  // Make sure the capture channel is set to input mode
-  TIMER_4_CAPTURE_INPUT      |= TIMER_4_ENABLE_INPUT_CAPTURE;   // Enable capturing data on TIM4
+void timebase_init(){
+	TIMEBASE_CLOCK |= TIMEBASE_ENABLE;
+	TIMEBASE_TIMER->PSC = TIMEBASE_PRESCALER;
+	TIMEBASE_TIMER->ARR = TIMEBASE_RELOAD;
+
+	// Force the load of the prescaler value, then start counting from zero
+	TIMEBASE_TIMER->EGR |= TIM_EGR_UG;
+	TIMEBASE_TIMER->CNT = 0;
+	TIMEBASE_TIMER->CR1 |= TIM_CR1_CEN;
 }
 
 /*
-  Helper function to enable the capture bit on the TIM3 or TIM4 device so
-  it starts counting
-*/
-void start_timer(int servo_num){
-	if(servo_num == SERVO_0){
-		TIMER_3_CAPTURE |= TIMER_3_ENABLE_INPUT_CAPTURE;
-	}
-	else {
-		TIMER_4_CAPTURE |= TIMER_4_ENABLE_INPUT_CAPTURE;
-	}
-}
+  Helper function that returns the current time on the shared timebase
 
-/*
-	This helper function starts both of the timers
+  Output: An unsigned 32bit integer holding the number of microseconds since
+          timebase_init, wrapping around every ~71 minutes
 */
-void start_timers(){
-	for(int servo_num = 0; servo_num < NUMBER_OF_SERVOS; servo_num++){
-		start_timer(servo_num);
-	}
+uint32_t now(){
+	return hal_timebase_now();
 }
 
 /*
-  Helper function to disable the capture bit on the TIM3 or TIM4 device so
-  it stops counting
-*/
-void stop_timer(int servo_num){
-	if(servo_num == SERVO_0){
-		TIMER_3_CAPTURE &= TIMER_3_DISABLE_INPUT_CAPTURE;
-	}
-	else {
-		TIMER_4_CAPTURE &= TIMER_4_DISABLE_INPUT_CAPTURE;
-	}
-}
+	Helper function to compare two times on the shared timebase.  The subtraction
+	wraps with the counter, so this stays correct across the wrap as long as the
+	two times are less than half the counter range (~35 minutes) apart
 
-/*
-	This helper function stops both of the timers
+	Input:
+		first  - The time that might be earlier
+		second - The time to compare it against
+
+	Output:
+		1 if first comes before second, 0 otherwise
 */
-void stop_timers(){
-	for(int servo_num = 0; servo_num < NUMBER_OF_SERVOS; servo_num++){
-		stop_timer(servo_num);
-	}
+int time_before(uint32_t first, uint32_t second){
+	return ((int32_t)(first - second) < 0);
 }
 
 /*
-  Helper function that returns the value of the current
-  count in the TIM3 or TIM4 results register
+	Helper function to tell if a deadline on the shared timebase has passed
 
-  Output: An unsigned 16bit integer that represents the value
-          in the register, this value is the millisecond
-          representation of the current measurement of the time
+	Input:
+		deadline - The time to check against
+
+	Output:
+		1 if the current time is at or after the deadline, 0 otherwise
 */
-uint16_t get_current_measurement(int servo_num){
-	if(servo_num == SERVO_0){
-		return (uint16_t)TIMER_3_CLOCK_TIMER_RESULTS;
-	}
-	else {
-		return (uint16_t)TIMER_4_CLOCK_TIMER_RESULTS;
-	}
+int time_reached(uint32_t deadline){
+	return !time_before(now(), deadline);
 }
 
 /*
-  Helper function that returns the value of the current
-  count in the TIM3 or TIM4 clock count register
+	Helper function to work out a deadline from a start time and a delay
+
+	Input:
+		start_time - The time on the shared timebase the delay starts at
+		delay_time - The number of milliseconds to wait
 
-  Output: An unsigned 16bit integer that represents the value
-          in the register, this value is the millisecond
-          representation of the current measurement of the count
+	Output:
+		The time on the shared timebase when the delay is over
 */
-uint16_t get_current_time(int servo_num){
-	if(servo_num == SERVO_0){
-		return (uint16_t)TIMER_3_COUNT;
-	}
-	else {
-		return (uint16_t)TIMER_4_COUNT;
-	}
+uint32_t deadline_after(uint32_t start_time, uint32_t delay_time){
+	return start_time + (delay_time * TICKS_PER_MILLISECOND);
 }
@@ -13,52 +13,52 @@
 void timer_init(void);
 
 /*
-  Helper function to enable the capture bit on the TIM3 or TIM4 device so
-  it starts counting
+	This function starts TIM5 counting freely in microseconds.  Every servo shares
+	this one clock, so TIM3 and TIM4 are no longer needed for timing moves
 */
-void start_timer(int servo_num);
+void timebase_init(void);
 
 /*
-	This helper function starts both of the timers
-*/
-void start_timers(void);
-
+  Helper function that returns the current time on the shared timebase
 
-/*
-  Helper function to disable the capture bit on the TIM3 or TIM4 device so
-  it stops counting
+  Output: An unsigned 32bit integer holding the number of microseconds since
+          timebase_init, wrapping around every ~71 minutes
 */
-void stop_timer(int servo_num);
+uint32_t now(void);
 
 /*
-	This helper function starts both of the timers
-*/
-void stop_timers(void);
+	Helper function to compare two times on the shared timebase.  The subtraction
+	wraps with the counter, so this stays correct across the wrap as long as the
+	two times are less than half the counter range (~35 minutes) apart
 
+	Input:
+		first  - The time that might be earlier
+		second - The time to compare it against
 
-/*
-  Helper function to take care of initializing the timer registers
-	for timing the servos.  Loads the prescaler value (forces the load),
-	then enables capture input
+	Output:
+		1 if first comes before second, 0 otherwise
 */
-void servo_timers_init(void);
+int time_before(uint32_t first, uint32_t second);
 
 /*
-  Helper function that returns the value of the current
-  count in the TIM3 or TIM4 results register
+	Helper function to tell if a deadline on the shared timebase has passed
+
+	Input:
+		deadline - The time to check against
 
-  Output: An unsigned 16bit integer that represents the value
-          in the register, this value is the millisecond
-          representation of the current measurement of the time
+	Output:
+		1 if the current time is at or after the deadline, 0 otherwise
 */
-uint16_t get_current_measurement(int servo_num);
+int time_reached(uint32_t deadline);
 
 /*
-  Helper function that returns the value of the current
-  count in the TIM3 or TIM4 clock count register
+	Helper function to work out a deadline from a start time and a delay
+
+	Input:
+		start_time - The time on the shared timebase the delay starts at
+		delay_time - The number of milliseconds to wait
 
-  Output: An unsigned 16bit integer that represents the value
-          in the register, this value is the millisecond
-          representation of the current measurement of the count
+	Output:
+		The time on the shared timebase when the delay is over
 */
-uint16_t get_current_time(int servo_num);
+uint32_t deadline_after(uint32_t start_time, uint32_t delay_time);
@@ -0,0 +1,305 @@
+/*
+  The timing wheel file keeps every deadline in the program (servo moves, waits,
+  timeouts) in a three level hierarchical timing wheel driven by one compare channel
+  on TIM5.  Scheduling, cancelling and expiring a timer are all O(1) no matter how
+  many timers are waiting.  The compare is pointed straight at the next tick that has
+  work in it, so the core is not woken up for empty ticks while it sleeps
+*/
+
+#include "TIMING_WHEEL.h"
+#include "TIMER.h"
+#include "HAL.h"
+
+// The slots of each level, every slot is a list of the timers that land in it
+static INSTANCE wheel_timer *wheel_level_0[WHEEL_LEVEL_0_SIZE];
+static INSTANCE wheel_timer *wheel_level_1[WHEEL_LEVEL_SIZE];
+static INSTANCE wheel_timer *wheel_level_2[WHEEL_LEVEL_SIZE];
+
+// One bit per level 0 slot that has timers in it, so we can find the next busy tick quickly
+static INSTANCE uint32_t wheel_level_0_occupied[WHEEL_LEVEL_0_SIZE / WHEEL_BITS_PER_WORD];
+
+// The tick the wheel has processed up to, and where that tick is on the timebase
+static INSTANCE uint32_t wheel_tick;
+static INSTANCE uint32_t wheel_time;
+static INSTANCE int wheel_timer_count;
+
+/*
+	This helper function puts a timer into the slot that matches how far away its
+	expiry tick is.  Timers too far out for the wheel are parked in the last level
+	and placed again when that slot is cascaded
+
+	Input:
+		timer - The timer to place, its expiry_tick must already be set
+*/
+static void wheel_link(wheel_timer *timer){
+	uint32_t expiry_tick = timer->expiry_tick;
+	int32_t ticks_left = (int32_t)(expiry_tick - wheel_tick);
+	wheel_timer **slot;
+
+	// Only a cascade can hand us a timer for the current tick, and the current slot
+	// is expired straight after the cascade
+	if(ticks_left < 0){
+		expiry_tick = wheel_tick;
+		ticks_left = 0;
+	}
+
+	if(ticks_left < WHEEL_LEVEL_0_SIZE){
+		slot = &wheel_level_0[expiry_tick & WHEEL_LEVEL_0_MASK];
+		wheel_level_0_occupied[(expiry_tick & WHEEL_LEVEL_0_MASK) / WHEEL_BITS_PER_WORD] |= (1U << (expiry_tick % WHEEL_BITS_PER_WORD));
+	}
+	else if(ticks_left < (1 << WHEEL_LEVEL_2_SHIFT)){
+		slot = &wheel_level_1[(expiry_tick >> WHEEL_LEVEL_1_SHIFT) & WHEEL_LEVEL_MASK];
+	}
+	else {
+		if(ticks_left > WHEEL_MAX_TICKS){
+			expiry_tick = wheel_tick + WHEEL_MAX_TICKS;
+		}
+		slot = &wheel_level_2[(expiry_tick >> WHEEL_LEVEL_2_SHIFT) & WHEEL_LEVEL_MASK];
+	}
+
+	// Push the timer on the front of the slot
+	timer->slot = slot;
+	timer->previous = NULL;
+	timer->next = *slot;
+	if(*slot != NULL){
+		(*slot)->previous = timer;
+	}
+	*slot = timer;
+}
+
+/*
+	This helper function takes a timer out of whatever slot it is in
+
+	Input:
+		timer - The timer to remove, it must be scheduled
+*/
+static void wheel_unlink(wheel_timer *timer){
+	int level_0_index;
+
+	if(timer->previous != NULL){
+		timer->previous->next = timer->next;
+	}
+	else {
+		*timer->slot = timer->next;
+
+		// Keep the occupied bits right when a level 0 slot empties out
+		level_0_index = timer->slot - wheel_level_0;
+		if((*timer->slot == NULL) && (level_0_index >= 0) && (level_0_index < WHEEL_LEVEL_0_SIZE)){
+			wheel_level_0_occupied[level_0_index / WHEEL_BITS_PER_WORD] &= ~(1U << (level_0_index % WHEEL_BITS_PER_WORD));
+		}
+	}
+	if(timer->next != NULL){
+		timer->next->previous = timer->previous;
+	}
+	timer->next = NULL;
+	timer->previous = NULL;
+	timer->slot = NULL;
+}
+
+/*
+	This helper function moves every timer in a slot of an outer level down into
+	the slot it belongs in now that its expiry is closer
+
+	Input:
+		slot - The outer level slot to empty
+*/
+static void wheel_cascade(wheel_timer **slot){
+	wheel_timer *timer = *slot;
+	wheel_timer *next;
+	*slot = NULL;
+
+	while(timer != NULL){
+		next = timer->next;
+		wheel_link(timer);
+		timer = next;
+	}
+}
+
+/*
+	This helper function counts the ticks until the next one with work in it, either
+	a level 0 slot with timers or the level 0 wrap where the outer levels cascade
+
+	Output:
+		The number of ticks from the current tick to the next busy one (at least 1)
+*/
+static uint32_t wheel_ticks_until_work(){
+	uint32_t index = (wheel_tick + 1) & WHEEL_LEVEL_0_MASK;
+	uint32_t ticks = 1;
+	uint32_t occupied;
+
+	// Search a whole word of slots at a time, stopping at the wrap
+	while((index != 0) && (index < WHEEL_LEVEL_0_SIZE)){
+		occupied = wheel_level_0_occupied[index / WHEEL_BITS_PER_WORD] >> (index % WHEEL_BITS_PER_WORD);
+		if(occupied != 0){
+			return ticks + __CLZ(__RBIT(occupied));
+		}
+		ticks += WHEEL_BITS_PER_WORD - (index % WHEEL_BITS_PER_WORD);
+		index += WHEEL_BITS_PER_WORD - (index % WHEEL_BITS_PER_WORD);
+	}
+	return ticks;
+}
+
+/*
+	This helper function moves the wheel forward to the next busy tick, cascading
+	the outer levels whenever the inner level wraps, then runs every timer that expired
+
+	Input:
+		ticks - The number of ticks to move forward, from wheel_ticks_until_work.
+		        Every tick skipped over is known to be empty
+*/
+static void wheel_advance(uint32_t ticks){
+	wheel_timer **slot;
+	wheel_timer *timer;
+
+	wheel_time += ticks * WHEEL_TICK_TIME;
+	wheel_tick += ticks;
+
+	// Level 0 wrapped, so bring the next level 1 slot (and if that wrapped, level 2) down
+	if((wheel_tick & WHEEL_LEVEL_0_MASK) == 0){
+		if(((wheel_tick >> WHEEL_LEVEL_1_SHIFT) & WHEEL_LEVEL_MASK) == 0){
+			wheel_cascade(&wheel_level_2[(wheel_tick >> WHEEL_LEVEL_2_SHIFT) & WHEEL_LEVEL_MASK]);
+		}
+		wheel_cascade(&wheel_level_1[(wheel_tick >> WHEEL_LEVEL_1_SHIFT) & WHEEL_LEVEL_MASK]);
+	}
+
+	// Take the timers off one at a time, a callback is allowed to cancel or schedule others
+	slot = &wheel_level_0[wheel_tick & WHEEL_LEVEL_0_MASK];
+	while(*slot != NULL){
+		timer = *slot;
+		wheel_unlink(timer);
+		wheel_timer_count--;
+		timer->callback(timer->context);
+	}
+}
+
+/*
+	This helper function points the TIM5 compare at the next tick with work in it.
+	Any busy tick that has already gone by is processed here, and the interrupt is
+	turned off once the wheel is empty so an idle wheel costs nothing
+*/
+static void wheel_arm(){
+	uint32_t ticks;
+	uint32_t next_tick_time;
+
+	while(wheel_timer_count > 0){
+		ticks = wheel_ticks_until_work();
+		next_tick_time = wheel_time + (ticks * WHEEL_TICK_TIME);
+		hal_timebase_arm(next_tick_time);
+
+		// A compare value that is already behind the count would not fire for ~71 minutes
+		if(time_before(now(), next_tick_time)){
+			return;
+		}
+		wheel_advance(ticks);
+	}
+	hal_timebase_disarm();
+}
+
+/*
+	This function clears the wheel and gets the TIM5 compare interrupt ready.
+	timebase_init must have already started TIM5
+*/
+void timing_wheel_init(){
+	for(int slot = 0; slot < WHEEL_LEVEL_0_SIZE; slot++){
+		wheel_level_0[slot] = NULL;
+	}
+	for(int slot = 0; slot < WHEEL_LEVEL_SIZE; slot++){
+		wheel_level_1[slot] = NULL;
+		wheel_level_2[slot] = NULL;
+	}
+	for(int word = 0; word < (WHEEL_LEVEL_0_SIZE / WHEEL_BITS_PER_WORD); word++){
+		wheel_level_0_occupied[word] = 0;
+	}
+	wheel_tick = 0;
+	wheel_time = now();
+	wheel_timer_count = 0;
+
+	hal_timebase_disarm();
+	hal_timebase_clear();
+	NVIC_SetPriority(TIMEBASE_IRQ, TIMEBASE_PRIORITY);
+	NVIC_EnableIRQ(TIMEBASE_IRQ);
+}
+
+/*
+	This function registers a deadline with the wheel.  Inserting is O(1), and a
+	timer that is already scheduled is moved to its new deadline
+
+	Input:
+		timer    - The timer to schedule, owned by the caller
+		deadline - The time on the shared timebase the callback should run at (or after)
+		callback - The function to run from the TIM5 interrupt once the deadline passes
+		context  - Passed to the callback
+*/
+void timing_wheel_schedule(wheel_timer *timer, uint32_t deadline, wheel_callback callback, void *context){
+	uint32_t interrupts = __get_PRIMASK();
+	int32_t time_left;
+	__disable_irq();
+
+	if(timer->slot != NULL){
+		wheel_unlink(timer);
+		wheel_timer_count--;
+	}
+
+	// Nothing is counting ticks while the wheel is empty, so catch the wheel up to now
+	if(wheel_timer_count == 0){
+		wheel_time = now();
+	}
+
+	// Round up so the callback never runs before its deadline.  The current tick has
+	// already been processed, so the soonest a timer can expire is the next one
+	time_left = (int32_t)(deadline - wheel_time);
+	if(time_left < WHEEL_TICK_TIME){
+		time_left = WHEEL_TICK_TIME;
+	}
+	timer->expiry_tick = wheel_tick + ((time_left + WHEEL_TICK_TIME - 1) / WHEEL_TICK_TIME);
+	timer->callback = callback;
+	timer->context = context;
+	wheel_link(timer);
+	wheel_timer_count++;
+
+	// The new timer may be due before the tick the compare is waiting for
+	if(wheel_timer_count == 1){
+		hal_timebase_clear();
+	}
+	wheel_arm();
+	__set_PRIMASK(interrupts);
+}
+
+/*
+	This function removes a timer from the wheel without running its callback
+
+	Input:
+		timer - The timer to cancel, nothing happens if it is not scheduled
+*/
+void timing_wheel_cancel(wheel_timer *timer){
+	uint32_t interrupts = __get_PRIMASK();
+	__disable_irq();
+
+	if(timer->slot != NULL){
+		wheel_unlink(timer);
+		wheel_timer_count--;
+	}
+	__set_PRIMASK(interrupts);
+}
+
+/*
+	Helper function to tell if a timer is still waiting for its deadline
+
+	Input:
+		timer - The timer to check
+
+	Output:
+		1 if the timer is in the wheel, 0 otherwise
+*/
+int timing_wheel_pending(wheel_timer *timer){
+	return (timer->slot != NULL);
+}
+
+/*
+	The TIM5 compare interrupt fires at the next tick with work in it.  Catch up on
+	every busy tick that has gone by, then point the compare at the next one
+*/
+void TIM5_IRQHandler(void){
+	hal_timebase_clear();
+	wheel_arm();
+}
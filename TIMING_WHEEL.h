@@ -0,0 +1,44 @@
+/*
+  Function declarations for the hierarchical timing wheel that tracks every deadline
+  in the program on the TIM5 timebase
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function clears the wheel and gets the TIM5 compare interrupt ready.
+	timebase_init must have already started TIM5
+*/
+void timing_wheel_init(void);
+
+/*
+	This function registers a deadline with the wheel.  Inserting is O(1), and a
+	timer that is already scheduled is moved to its new deadline
+
+	Input:
+		timer    - The timer to schedule, owned by the caller
+		deadline - The time on the shared timebase the callback should run at (or after)
+		callback - The function to run from the TIM5 interrupt once the deadline passes
+		context  - Passed to the callback
+*/
+void timing_wheel_schedule(wheel_timer *timer, uint32_t deadline, wheel_callback callback, void *context);
+
+/*
+	This function removes a timer from the wheel without running its callback
+
+	Input:
+		timer - The timer to cancel, nothing happens if it is not scheduled
+*/
+void timing_wheel_cancel(wheel_timer *timer);
+
+/*
+	Helper function to tell if a timer is still waiting for its deadline
+
+	Input:
+		timer - The timer to check
+
+	Output:
+		1 if the timer is in the wheel, 0 otherwise
+*/
+int timing_wheel_pending(wheel_timer *timer);
@@ -0,0 +1,202 @@
+/*
+  The trace file captures a waveform of the controller's outputs, the same thing a
+  logic analyzer on the servo and LED pins would show.  Every pulse width change and
+  every LED change is stored with its timebase time in a ring, which costs a few
+  stores inside the HAL call.  The lowest priority task sends the ring out in frames
+  of up to TRACE_FLUSH_SIZE records, straight from the ring, so the console sees a few
+  big writes instead of one per change.  sim/trace_vcd turns the frames into a VCD file
+
+  Only changes are recorded.  The LEDs are rewritten on every status update, so the
+  last value of every output is kept to drop the writes that change nothing
+*/
+
+#include "TRACE.h"
+#include "HAL.h"
+#include "SCHEDULER.h"
+
+#include <string.h>
+
+// Set while the waveform trace is captured
+INSTANCE int trace_enabled = TRACE_DEFAULT;
+
+// The ring, trace_write counts records stored and trace_read records sent
+static INSTANCE trace_record trace_ring[TRACE_RING_SIZE];
+static INSTANCE uint32_t trace_write;
+static INSTANCE uint32_t trace_read;
+
+// Records dropped since the last one that fit, sent as a TRACE_KIND_LOST record
+static INSTANCE uint32_t trace_lost;
+
+// The last value recorded for every output, TRACE_UNKNOWN until the first one
+static INSTANCE int trace_last_pwm[NUMBER_OF_PWM_CHANNELS];
+static INSTANCE int trace_last_led[NUMBER_OF_TRACE_LEDS];
+
+/*
+	This helper function stores one record, the caller has interrupts off and has
+	checked there is room
+
+	Input:
+		time    - The timebase time of the change
+		kind    - The TRACE_KIND of the record
+		channel - The servo or LED that changed
+		value   - The value of the record
+*/
+static void trace_store(uint32_t time, int kind, int channel, int value){
+	trace_record *record = &trace_ring[trace_write & TRACE_RING_MASK];
+
+	record->time = time;
+	record->kind = kind;
+	record->channel = channel;
+	record->value = value;
+	trace_write++;
+}
+
+/*
+	This function records one output change in the trace ring.  It only stores the
+	record, the trace task sends it out later, so the servos keep their timing.  The
+	HAL only calls it while trace_enabled is set
+
+	Input:
+		kind    - TRACE_KIND_PWM or TRACE_KIND_LED
+		channel - The servo or LED that changed
+		value   - The new pulse width, or 1 for an LED that is now on
+*/
+void trace_event(int kind, int channel, int value){
+	uint32_t interrupts = __get_PRIMASK();
+	uint32_t time = hal_timebase_now();
+	int *last;
+	uint32_t waiting;
+
+	if((kind == TRACE_KIND_PWM) && (channel >= 0) && (channel < NUMBER_OF_PWM_CHANNELS)){
+		last = &trace_last_pwm[channel];
+	}
+	else if((kind == TRACE_KIND_LED) && (channel >= 0) && (channel < NUMBER_OF_TRACE_LEDS)){
+		last = &trace_last_led[channel];
+	}
+	else {
+		return;
+	}
+
+	__disable_irq();
+	if(*last == value){
+		__set_PRIMASK(interrupts);
+		return;
+	}
+
+	// A lost record goes in ahead of the change, so it needs a slot of its own
+	waiting = trace_write - trace_read;
+	if(waiting + ((trace_lost != 0) ? 2 : 1) > TRACE_RING_SIZE){
+		trace_lost++;
+		__set_PRIMASK(interrupts);
+		return;
+	}
+	if(trace_lost != 0){
+		trace_store(time, TRACE_KIND_LOST, 0, trace_lost);
+		trace_lost = 0;
+	}
+	trace_store(time, kind, channel, value);
+	*last = value;
+	waiting = trace_write - trace_read;
+	__set_PRIMASK(interrupts);
+
+	if(waiting >= TRACE_FLUSH_SIZE){
+		task_signal(TASK_TRACE, TASK_EVENT_TRACE);
+	}
+}
+
+/*
+	This function starts or stops the capture.  Starting empties the ring and forgets
+	every output, so the first write to each one is recorded.  Stopping sends
+	whatever is left in the ring
+
+	Input:
+		enable - TRACE_ON or TRACE_OFF
+*/
+void trace_enable(int enable){
+	uint32_t interrupts = __get_PRIMASK();
+
+	if(enable){
+		__disable_irq();
+		trace_read = trace_write;
+		trace_lost = 0;
+		for(int channel = 0; channel < NUMBER_OF_PWM_CHANNELS; channel++){
+			trace_last_pwm[channel] = TRACE_UNKNOWN;
+		}
+		for(int channel = 0; channel < NUMBER_OF_TRACE_LEDS; channel++){
+			trace_last_led[channel] = TRACE_UNKNOWN;
+		}
+		trace_enabled = TRACE_ON;
+		__set_PRIMASK(interrupts);
+	}
+	else {
+		trace_enabled = TRACE_OFF;
+		trace_flush();
+	}
+}
+
+/*
+	This helper function sends one frame from the front of the ring.  The records
+	go out straight from the ring, so a frame stops at the end of it
+
+	Input:
+		limit - The most records to send
+
+	Output:
+		The number of records sent
+*/
+static uint32_t trace_send_frame(uint32_t limit){
+	uint8_t header[TRACE_FRAME_HEADER_SIZE];
+	uint32_t start = trace_read & TRACE_RING_MASK;
+	uint32_t count = trace_write - trace_read;
+
+	if(count > limit){
+		count = limit;
+	}
+	if(start + count > TRACE_RING_SIZE){
+		count = TRACE_RING_SIZE - start;
+	}
+	if(count == 0){
+		return 0;
+	}
+
+	memcpy(header, TRACE_SYNC, TRACE_SYNC_SIZE);
+	header[TRACE_SYNC_SIZE] = count & 0xFF;
+	header[TRACE_SYNC_SIZE + 1] = (count >> 8) & 0xFF;
+	hal_trace_write(header, TRACE_FRAME_HEADER_SIZE);
+	hal_trace_write((uint8_t *)&trace_ring[start], count * TRACE_RECORD_SIZE);
+	trace_read += count;
+	return count;
+}
+
+/*
+	This function sends every record in the ring, in as few frames as it can
+*/
+void trace_flush(){
+	while(trace_send_frame(TRACE_FLUSH_SIZE) != 0){
+	}
+}
+
+/*
+	The trace task sends the ring out a frame at a time once it fills up.  It has
+	the lowest priority, so it only runs when nothing else has work.  A frame is cut
+	down to what fits in the TX buffer and goes out in one piece, so the task never
+	waits for the console.  Once there is no room it stops, and the TX drain task
+	wakes it again when the buffer has emptied
+
+	Input:
+		events  - The TASK_EVENT flags that woke the task up
+		context - Not used
+*/
+void trace_task(uint32_t events, void *context){
+	uint32_t room;
+	uint32_t limit;
+
+	while((trace_write - trace_read) >= TRACE_FLUSH_SIZE){
+		room = hal_trace_room();
+		limit = (room < TRACE_FRAME_HEADER_SIZE) ? 0 : ((room - TRACE_FRAME_HEADER_SIZE) / TRACE_RECORD_SIZE);
+		if(limit < TRACE_FRAME_MIN){
+			return;
+		}
+		trace_send_frame((limit < TRACE_FLUSH_SIZE) ? limit : TRACE_FLUSH_SIZE);
+	}
+}
@@ -0,0 +1,43 @@
+/*
+  Function declarations for the waveform trace of the servo and LED outputs
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function records one output change in the trace ring.  It only stores the
+	record, the trace task sends it out later, so the servos keep their timing.  The
+	HAL only calls it while trace_enabled is set
+
+	Input:
+		kind    - TRACE_KIND_PWM or TRACE_KIND_LED
+		channel - The servo or LED that changed
+		value   - The new pulse width, or 1 for an LED that is now on
+*/
+void trace_event(int kind, int channel, int value);
+
+/*
+	This function starts or stops the capture.  Starting empties the ring and forgets
+	every output, so the first write to each one is recorded.  Stopping sends
+	whatever is left in the ring
+
+	Input:
+		enable - TRACE_ON or TRACE_OFF
+*/
+void trace_enable(int enable);
+
+/*
+	This function sends every record in the ring, in as few frames as it can
+*/
+void trace_flush(void);
+
+/*
+	The trace task sends the ring out a frame at a time once it fills up.  It has
+	the lowest priority, so it only runs when nothing else has work
+
+	Input:
+		events  - The TASK_EVENT flags that woke the task up
+		context - Not used
+*/
+void trace_task(uint32_t events, void *context);
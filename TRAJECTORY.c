@@ -0,0 +1,202 @@
+/*
+  The trajectory file streams precomputed CCR values into TIM2 with a DMA burst on
+  every update event.  The DMA plays a circular buffer split into two halves, and
+  the CPU refills whichever half just finished while the other half plays
+*/
+
+#include "TRAJECTORY.h"
+#include "HAL.h"
+
+// The circular buffer the DMA plays out of
+static INSTANCE uint32_t trajectory_buffer[TRAJECTORY_BUFFER_SIZE];
+
+// Keep track of where we are in the callers precomputed trajectory
+static INSTANCE const uint32_t *trajectory_source;
+static INSTANCE int trajectory_source_frames;
+static INSTANCE int trajectory_source_index;
+static INSTANCE int trajectory_loop;
+
+// Keep track of which halves of the buffer still hold frames from the trajectory,
+// once neither does the trajectory has been played all the way through
+static INSTANCE int trajectory_half_has_frames[2];
+static INSTANCE volatile int trajectory_running;
+
+/*
+	This helper function copies the next half buffer worth of frames out of the
+	trajectory.  Once a non looping trajectory runs out, the last frame is held
+
+	Input:
+		half - TRAJECTORY_FIRST_HALF or TRAJECTORY_SECOND_HALF
+*/
+static void trajectory_fill_half(int half){
+	uint32_t *destination = &trajectory_buffer[half * TRAJECTORY_HALF_SIZE];
+	const uint32_t *frame;
+	trajectory_half_has_frames[half] = 0;
+
+	for(int frame_index = 0; frame_index < TRAJECTORY_HALF_FRAMES; frame_index++){
+
+		// Wrap around or hold the last frame when we run out of trajectory
+		if(trajectory_source_index >= trajectory_source_frames){
+			if(trajectory_loop){
+				trajectory_source_index = 0;
+			}
+		}
+		if(trajectory_source_index < trajectory_source_frames){
+			frame = &trajectory_source[trajectory_source_index * TRAJECTORY_FRAME_SIZE];
+			trajectory_source_index++;
+			trajectory_half_has_frames[half] = 1;
+		}
+		else {
+			frame = &trajectory_source[(trajectory_source_frames - 1) * TRAJECTORY_FRAME_SIZE];
+		}
+
+		// Copy one CCR value per servo, in the order the burst writes them
+		for(int servo_num = 0; servo_num < TRAJECTORY_FRAME_SIZE; servo_num++){
+			destination[servo_num] = frame[servo_num];
+		}
+		destination += TRAJECTORY_FRAME_SIZE;
+	}
+}
+
+/*
+	This function gets DMA1 channel 2 ready to burst CCR values into TIM2 on every
+	update event.  timer_init must have already set up the TIM2 channels
+*/
+void trajectory_init(){
+
+	// Enable the DMA clock and route the TIM2 update request to channel 2
+	DMA_1 |= DMA_1_ENABLE;
+	DMA_1_REQUEST_SELECT &= ~TRAJECTORY_DMA_REQUEST_MASK;
+	DMA_1_REQUEST_SELECT |= TRAJECTORY_DMA_REQUEST_TIM2_UP;
+
+	// Every burst starts at CCR1 and writes one register per servo
+	TIMER_2_DMA_CONTROL = TIMER_2_DMA_BURST_CCR1 | ((TRAJECTORY_FRAME_SIZE - 1) << TIMER_2_DMA_BURST_LENGTH_SHIFT);
+
+	// Every burst goes through the DMAR register, TIM2 steps through the CCRs for us
+	TRAJECTORY_DMA->CCR = TRAJECTORY_DMA_CONFIGURATION;
+	TRAJECTORY_DMA->CPAR = (uint32_t)(uintptr_t)&TIMER_2_DMA_BURST;
+
+	NVIC_SetPriority(TRAJECTORY_DMA_IRQ, TRAJECTORY_DMA_PRIORITY);
+	NVIC_EnableIRQ(TRAJECTORY_DMA_IRQ);
+}
+
+/*
+	This function starts playing a precomputed trajectory.  Each frame holds one
+	CCR value per servo and is played for one servo period
+
+	Input:
+		ccr_values  - The frames to play, TRAJECTORY_FRAME_SIZE values per frame
+		frame_count - The number of frames in ccr_values
+		loop        - TRAJECTORY_LOOP to replay forever, TRAJECTORY_NO_LOOP to stop at the end
+
+	Output:
+		SUCCESS if playback started, FAILURE if there was nothing to play
+*/
+int trajectory_start(const uint32_t *ccr_values, int frame_count, int loop){
+	if((ccr_values == NULL) || (frame_count <= 0)){
+		return FAILURE;
+	}
+
+	// Make sure an older trajectory is not still playing while we swap the buffer
+	trajectory_stop();
+
+	trajectory_source = ccr_values;
+	trajectory_source_frames = frame_count;
+	trajectory_source_index = 0;
+	trajectory_loop = loop;
+
+	// Fill both halves up front so the first refill has a whole half to work in
+	trajectory_fill_half(TRAJECTORY_FIRST_HALF);
+	trajectory_fill_half(TRAJECTORY_SECOND_HALF);
+
+	// Start the DMA, TIM2 requests a burst on the next update event
+	trajectory_running = 1;
+	hal_trajectory_start(trajectory_buffer, TRAJECTORY_BUFFER_SIZE);
+	return SUCCESS;
+}
+
+/*
+	This function stops playback, the servos hold whatever CCR values were
+	last played
+*/
+void trajectory_stop(){
+	hal_trajectory_stop();
+	trajectory_running = 0;
+}
+
+/*
+	Helper function to tell if a trajectory is still playing
+
+	Output:
+		1 if the DMA still owns the TIM2 CCR registers, 0 otherwise
+*/
+int trajectory_active(){
+	return trajectory_running;
+}
+
+/*
+	This helper function builds a linear ramp between two sets of positions using
+	the duty table in TIMER.c, so callers do not have to know the CCR values
+
+	Input:
+		ccr_values  - The frames to fill, TRAJECTORY_FRAME_SIZE values per frame
+		frame_count - The number of frames to fill
+		start       - The position each servo starts in
+		end         - The position each servo finishes in
+*/
+void trajectory_build_ramp(uint32_t *ccr_values, int frame_count, position start[TRAJECTORY_FRAME_SIZE], position end[TRAJECTORY_FRAME_SIZE]){
+	int start_ccr, end_ccr;
+
+	for(int frame_index = 0; frame_index < frame_count; frame_index++){
+		for(int servo_num = 0; servo_num < TRAJECTORY_FRAME_SIZE; servo_num++){
+			start_ccr = positions[start[servo_num]];
+			end_ccr = positions[end[servo_num]];
+
+			// A single frame ramp is just the end position
+			if(frame_count == 1){
+				ccr_values[servo_num] = end_ccr;
+			}
+			else {
+				ccr_values[(frame_index * TRAJECTORY_FRAME_SIZE) + servo_num] = start_ccr + (((end_ccr - start_ccr) * frame_index) / (frame_count - 1));
+			}
+		}
+	}
+}
+
+/*
+	The DMA interrupt fires every time one half of the buffer has been played.  Refill
+	that half while the other half plays, and stop once a non looping trajectory has
+	played its last frame
+*/
+void DMA1_Channel2_IRQHandler(void){
+	uint32_t status = DMA_1_STATUS;
+	int finished_half;
+	int playing_half;
+
+	DMA_1_CLEAR_STATUS = TRAJECTORY_DMA_CLEAR;
+
+	// The DMA turns the channel off by itself on an error, let the servos hold
+	if(status & TRAJECTORY_DMA_TRANSFER_ERROR){
+		trajectory_stop();
+		return;
+	}
+
+	if(status & TRAJECTORY_DMA_HALF_TRANSFER){
+		finished_half = TRAJECTORY_FIRST_HALF;
+		playing_half = TRAJECTORY_SECOND_HALF;
+	}
+	else if(status & TRAJECTORY_DMA_TRANSFER_COMPLETE){
+		finished_half = TRAJECTORY_SECOND_HALF;
+		playing_half = TRAJECTORY_FIRST_HALF;
+	}
+	else {
+		return;
+	}
+
+	// Nothing left in the half that just started playing, so the last frame is already loaded
+	if(!trajectory_half_has_frames[playing_half]){
+		trajectory_stop();
+		return;
+	}
+	trajectory_fill_half(finished_half);
+}
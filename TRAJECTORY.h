@@ -0,0 +1,52 @@
+/*
+  Function declarations for streaming trajectories into the TIM2 CCR registers
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+/*
+	This function gets DMA1 channel 2 ready to burst CCR values into TIM2 on every
+	update event.  timer_init must have already set up the TIM2 channels
+*/
+void trajectory_init(void);
+
+/*
+	This function starts playing a precomputed trajectory.  Each frame holds one
+	CCR value per servo and is played for one servo period
+
+	Input:
+		ccr_values  - The frames to play, TRAJECTORY_FRAME_SIZE values per frame
+		frame_count - The number of frames in ccr_values
+		loop        - TRAJECTORY_LOOP to replay forever, TRAJECTORY_NO_LOOP to stop at the end
+
+	Output:
+		SUCCESS if playback started, FAILURE if there was nothing to play
+*/
+int trajectory_start(const uint32_t *ccr_values, int frame_count, int loop);
+
+/*
+	This function stops playback, the servos hold whatever CCR values were
+	last played
+*/
+void trajectory_stop(void);
+
+/*
+	Helper function to tell if a trajectory is still playing
+
+	Output:
+		1 if the DMA still owns the TIM2 CCR registers, 0 otherwise
+*/
+int trajectory_active(void);
+
+/*
+	This helper function builds a linear ramp between two sets of positions using
+	the duty table in TIMER.c, so callers do not have to know the CCR values
+
+	Input:
+		ccr_values  - The frames to fill, TRAJECTORY_FRAME_SIZE values per frame
+		frame_count - The number of frames to fill
+		start       - The position each servo starts in
+		end         - The position each servo finishes in
+*/
+void trajectory_build_ramp(uint32_t *ccr_values, int frame_count, position start[TRAJECTORY_FRAME_SIZE], position end[TRAJECTORY_FRAME_SIZE]);
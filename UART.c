@@ -1,5 +1,54 @@
 #include "UART.h"
+#include "HAL.h"
+#include "POWER.h"
+#include "DELAY.h"
+#include "SCHEDULER.h"
+#include "EMERGENCY_STOP.h"
 
+// Bytes received on USART2, filled by the RX interrupt and emptied by USART_Read
+static uint8_t USART2_Rx_Buffer[BufferSize];
+static volatile uint32_t USART2_Rx_Write_Counter = 0;
+static volatile uint32_t USART2_Rx_Read_Counter = 0;
+
+// The most cycles the RX interrupt has taken to store a byte, for the self test
+static volatile uint32_t USART2_Rx_Worst_Cycles = 0;
+
+// Bytes waiting to go out on USART2, filled by USART_Write and emptied by USART_Tx_Drain.
+// Both ends only run outside of interrupts, the TXE interrupt just wakes the drain task
+static uint8_t USART2_Tx_Buffer[TxBufferSize];
+static uint32_t USART2_Tx_Write_Counter = 0;
+static uint32_t USART2_Tx_Read_Counter = 0;
+
+// Wait conditions for the USART2 buffers
+static int USART2_Rx_Empty(void *context) {
+	return !USART_Data_Available(USART2);
+}
+
+static int USART2_Tx_Full(void) {
+	return (((USART2_Tx_Write_Counter + 1) % TxBufferSize) == USART2_Tx_Read_Counter);
+}
+
+// Sleeps until the TXE interrupt says USART2 takes another byte.  Interrupts still run,
+// other tasks do not.  USART_Tx_Drain has to have left bytes queued, so TXEIE is on
+static void USART2_Tx_Wait(void) {
+	uint32_t interrupts = __get_PRIMASK();
+
+	__disable_irq();
+	if (!(USART2->ISR & USART_ISR_TXE)) {
+		idle_enter();
+	}
+	__set_PRIMASK(interrupts);
+}
+
+// Hands USART2 the next byte, which clears TXE until the byte moves on to the shift register.
+// A plain memory write can not do that, so the simulator takes the byte itself
+static void USART2_Transmit(uint8_t data) {
+#ifdef HOST_BUILD
+	hal_host_usart_transmit(data);
+#else
+	USART2->TDR = data;
+#endif
+}
 
 // UART Ports:
 // ===================================================
@@ -22,8 +71,10 @@ void UART2_Init(void) {
 	UART2_GPIO_Init();
 	USART_Init(USART2);
 	
-	//NVIC_SetPriority(USART2_IRQn, 0);			// Set Priority to 1
-	//NVIC_EnableIRQ(USART2_IRQn);					// Enable interrupt of USART1 peripheral
+	// Receive through the interrupt so waiting for input can sleep
+	USART2->CR1 |= USART_CR1_RXNEIE;
+	NVIC_SetPriority(USART2_IRQn, USART_2_PRIORITY);
+	NVIC_EnableIRQ(USART2_IRQn);
 }
 
 void UART2_GPIO_Init(void) {
@@ -99,6 +150,16 @@ void USART_Init (USART_TypeDef * USARTx) {
 
 
 uint8_t USART_Read (USART_TypeDef * USARTx) {
+	uint8_t data;
+
+	// USART2 is interrupt driven, wait (running other tasks) until the interrupt hands us a byte
+	if (USARTx == USART2) {
+		delay_wait_while(USART2_Rx_Empty, NULL);
+		data = USART2_Rx_Buffer[USART2_Rx_Read_Counter];
+		USART2_Rx_Read_Counter = (USART2_Rx_Read_Counter + 1) % BufferSize;
+		return data;
+	}
+
 	// SR_RXNE (Read data register not empty) bit is set by hardware
 	while (!(USARTx->ISR & USART_ISR_RXNE));  // Wait until RXNE (RX not empty) bit is set
 	// USART resets the RXNE flag automatically after reading DR
@@ -107,6 +168,14 @@ uint8_t USART_Read (USART_TypeDef * USARTx) {
 }
 
 uint8_t USART_Read_No_Block (USART_TypeDef * USARTx) {
+	// USART2 is interrupt driven, only read when the interrupt has a byte for us
+	if (USARTx == USART2) {
+		if (USART_Data_Available(USART2)) {
+			return USART_Read(USART2);
+		}
+		return '\0';
+	}
+
 	// SR_RXNE (Read data register not empty) bit is set by hardware
 	if ((USARTx->ISR & USART_ISR_RXNE)) {
 		// Reading USART_DR automatically clears the RXNE flag 
@@ -118,8 +187,37 @@ uint8_t USART_Read_No_Block (USART_TypeDef * USARTx) {
 	}
 }
 
+int USART_Data_Available (USART_TypeDef * USARTx) {
+	if (USARTx == USART2) {
+		return (USART2_Rx_Read_Counter != USART2_Rx_Write_Counter);
+	}
+	return ((USARTx->ISR & USART_ISR_RXNE) != 0);
+}
+
 void USART_Write(USART_TypeDef * USARTx, uint8_t *buffer, uint32_t nBytes) {
 	int i;
+
+	// USART2 is buffered, queue the bytes and let the drain task send them.  A full buffer is
+	// waited out asleep instead of by running other tasks, so no other writer gets in the
+	// middle of this one and no task ever runs on top of a writer's stack
+	if (USARTx == USART2) {
+		for (i = 0; i < nBytes; i++) {
+			if (USART2_Tx_Full()) {
+				counters.tx_full++;
+			}
+			while (USART2_Tx_Full()) {
+				USART_Tx_Drain(USART2);                      // The drain task can not run while we wait, so make room ourselves
+				if (USART2_Tx_Full()) {
+					USART2_Tx_Wait();
+				}
+			}
+			USART2_Tx_Buffer[USART2_Tx_Write_Counter] = buffer[i];
+			USART2_Tx_Write_Counter = (USART2_Tx_Write_Counter + 1) % TxBufferSize;
+		}
+		USART_Tx_Drain(USART2);
+		return;
+	}
+
 	// TXE is cleared by a write to the USART_DR register.
 	// TXE is set by hardware when the content of the TDR 
 	// register has been transferred into the shift register.
@@ -132,11 +230,72 @@ void USART_Write(USART_TypeDef * USARTx, uint8_t *buffer, uint32_t nBytes) {
 	while (!(USARTx->ISR & USART_ISR_TC));   		  // wait until TC bit is set
 	USARTx->ISR &= ~USART_ISR_TC;
 }   
- 
+
+void USART_Tx_Drain(USART_TypeDef * USARTx) {
+	uint32_t interrupts;
+
+	if (USARTx != USART2) {
+		return;
+	}
+
+	// Hand the UART as many bytes as it will take right now
+	while ((USART2_Tx_Read_Counter != USART2_Tx_Write_Counter) && (USART2->ISR & USART_ISR_TXE)) {
+		USART2_Transmit(USART2_Tx_Buffer[USART2_Tx_Read_Counter]);
+		USART2_Tx_Read_Counter = (USART2_Tx_Read_Counter + 1) % TxBufferSize;
+	}
+
+	// Have the TXE interrupt wake the drain task once there is room for the rest
+	if (USART2_Tx_Read_Counter != USART2_Tx_Write_Counter) {
+		interrupts = __get_PRIMASK();
+		__disable_irq();
+		USART2->CR1 |= USART_CR1_TXEIE;
+		__set_PRIMASK(interrupts);
+	}
+}
+
+void USART_Tx_Flush(USART_TypeDef * USARTx) {
+
+	// Only USART2 queues its output, the others send before USART_Write returns
+	if (USARTx != USART2) {
+		return;
+	}
+	while (USART_Tx_Pending(USART2) > 0) {
+		USART_Tx_Drain(USART2);
+		if (USART_Tx_Pending(USART2) > 0) {
+			USART2_Tx_Wait();
+		}
+	}
+}
+
+uint32_t USART_Tx_Pending(USART_TypeDef * USARTx) {
+
+	// Only USART2 queues its output, the others send before USART_Write returns
+	if (USARTx != USART2) {
+		return 0;
+	}
+	return (USART2_Tx_Write_Counter + TxBufferSize - USART2_Tx_Read_Counter) % TxBufferSize;
+}
+
+uint32_t USART_Tx_Free(USART_TypeDef * USARTx) {
+
+	// Only USART2 queues its output, the others have no buffer to fill
+	if (USARTx != USART2) {
+		return 0;
+	}
+	return TxBufferSize - 1 - USART_Tx_Pending(USART2);
+}
+
+uint32_t USART_Rx_Worst_Cycles(USART_TypeDef * USARTx) {
+
+	// Only the USART2 RX interrupt times itself
+	if (USARTx != USART2) {
+		return 0;
+	}
+	return USART2_Rx_Worst_Cycles;
+}
 
 void USART_Delay(uint32_t us) {
-	uint32_t time = 100*us/7;    
-	while(--time);   
+	delay_us(us);                           // Timed by the delay service, not by how fast this loop compiles
 }
 
 void USART_IRQHandler(USART_TypeDef * USARTx, uint8_t *buffer, uint32_t * pRx_counter){
@@ -159,3 +318,39 @@ void USART_IRQHandler(USART_TypeDef * USARTx, uint8_t *buffer, uint32_t * pRx_co
 		while(1);     
 	}	
 }
+
+void USART2_IRQHandler(void) {
+	uint32_t start_cycles = cycles_now();          // The emergency stop is timed from here
+	uint32_t next;
+	uint32_t cycles;
+	uint8_t data;
+
+	if (USART2->ISR & USART_ISR_RXNE) {						// Received data
+		data = USART2->RDR;                         // Reading USART_DR automatically clears the RXNE flag
+		counters.bytes_in++;
+		if (command_table[data].flags & COMMAND_FLAG_STOP) {          // Stop right here, the console never sees this byte
+			emergency_stop(start_cycles);
+		} else {
+			next = (USART2_Rx_Write_Counter + 1) % BufferSize;
+			if (next != USART2_Rx_Read_Counter) {
+				USART2_Rx_Buffer[USART2_Rx_Write_Counter] = data;
+				USART2_Rx_Write_Counter = next;
+			} else {                                  // Buffer full, drop the byte rather than overwrite unread input
+				counters.rx_overruns++;
+			}
+			task_signal(TASK_CONSOLE, TASK_EVENT_RX);
+			cycles = cycles_now() - start_cycles;
+			if (cycles > USART2_Rx_Worst_Cycles) {
+				USART2_Rx_Worst_Cycles = cycles;
+			}
+		}
+	}
+	if ((USART2->CR1 & USART_CR1_TXEIE) && (USART2->ISR & USART_ISR_TXE)) {	// Room for another byte
+		USART2->CR1 &= ~USART_CR1_TXEIE;            // The drain task turns this back on if it needs to
+		task_signal(TASK_TX_DRAIN, TASK_EVENT_TX);
+	}
+	if (USART2->ISR & USART_ISR_ORE) {						// Overrun Error, clear it and keep receiving
+		USART2->ICR = USART_ICR_ORECF;
+		counters.rx_overruns++;
+	}
+}
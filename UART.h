@@ -4,6 +4,7 @@
 #include "stm32l476xx.h"
 
 #define BufferSize 32
+#define TxBufferSize 256
 
 void UART2_Init(void);
 void UART2_GPIO_Init(void);
@@ -13,6 +14,12 @@ void USART_Init(USART_TypeDef * USARTx);
 void USART_Write(USART_TypeDef * USARTx, uint8_t *buffer, uint32_t nBytes);
 uint8_t   USART_Read(USART_TypeDef * USARTx);
 uint8_t 	USART_Read_No_Block (USART_TypeDef * USARTx);
+int USART_Data_Available (USART_TypeDef * USARTx);
+void USART_Tx_Drain(USART_TypeDef * USARTx);
+void USART_Tx_Flush(USART_TypeDef * USARTx);
+uint32_t USART_Tx_Pending(USART_TypeDef * USARTx);
+uint32_t USART_Tx_Free(USART_TypeDef * USARTx);
+uint32_t USART_Rx_Worst_Cycles(USART_TypeDef * USARTx);
 void USART_Delay(uint32_t us);
 void USART_IRQHandler(USART_TypeDef * USARTx, uint8_t *buffer, uint32_t * pRx_counter);
 
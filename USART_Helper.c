@@ -4,6 +4,36 @@
 
 #include "USART_Helper.h"
 
+// USART_DROP_WHEN_FULL while a task nobody waits on is writing, see usart_write_when_full
+static INSTANCE int usart_when_full = USART_WAIT_WHEN_FULL;
+
+/*
+  Helper function that decides whether a line goes out.  Lines always do unless
+  they are being dropped when the TX buffer is full and this one does not fit
+
+  Input: length - The bytes in the line, newline included
+
+  Output: Returns 1 to write the line, 0 to drop it
+*/
+static int usart_line_fits(uint32_t length){
+  if((usart_when_full == USART_DROP_WHEN_FULL) && (hal_serial_tx_free() < length)){
+    counters.tx_dropped++;
+    return 0;
+  }
+  return 1;
+}
+
+/*
+  This function picks what a write does when the TX buffer has no room for it.
+  Waiting holds up every other task until the console catches up, so output
+  nobody is waiting on drops whole lines instead
+
+  Input: when_full - USART_WAIT_WHEN_FULL or USART_DROP_WHEN_FULL
+*/
+void usart_write_when_full(int when_full){
+  usart_when_full = when_full;
+}
+
 /*
   Helper function to handle the usart write function syntax.  Automatically adds
   the newlines to the string so we don't have to do that later
@@ -11,10 +41,14 @@
   Input: This function takes a string (character array pointer)
 */
 void usart_write_simple(char *message){
-  char buffer[strlen(message) + strlen(CARRIAGE_RETURN_NEWLINE)];
-  strcpy(buffer, message);
-  strcat(buffer, CARRIAGE_RETURN_NEWLINE);
-  USART_Write(USART2, (uint8_t *)buffer, strlen(buffer));
+
+  if(!usart_line_fits(strlen(message) + strlen(CARRIAGE_RETURN_NEWLINE))){
+    return;
+  }
+
+  // Both pieces go straight into the TX buffer, so the message is never copied on the stack
+  hal_serial_write((uint8_t *)message, strlen(message));
+  hal_serial_write((uint8_t *)CARRIAGE_RETURN_NEWLINE, strlen(CARRIAGE_RETURN_NEWLINE));
 }
 
 /*
@@ -24,14 +58,14 @@ void usart_write_simple(char *message){
          print_newline - Switch used to tell the function to print a newline as well as the data
 */
 void usart_real_time_write(char data, int print_newline){
-  char write_buffer[REAL_TIME_BUFFER_SIZE] = {NULL};
+  char write_buffer[REAL_TIME_BUFFER_SIZE] = {'\0'};
 
   // Copy in the data
   write_buffer[REAL_TIME_BUFFER_START] = data;
   
   // Use a regular write here so we don't get newlines, let the user know
   // what they are typing
-  USART_Write(USART2, (uint8_t *)write_buffer, sizeof(write_buffer));
+  hal_serial_write((uint8_t *)write_buffer, sizeof(write_buffer));
 
   // Write a newline
   if(print_newline){
@@ -55,12 +89,16 @@ void usart_write_data_string(char *message, ...){
   va_list data_points;
   va_start(data_points, message);
 
-  // I know this is bad form but I have no idea how to make a variable size function
-  // and compute a variable size list.  I used this just to make my life easier.  It works
+  // The buffer is the biggest thing on the stack, so it only holds OUTPUT_BUFFER_SIZE
+  // and anything longer is cut short rather than written past the end
   char buffer[OUTPUT_BUFFER_SIZE];
-  vsprintf(buffer, message, data_points);
+  vsnprintf(buffer, sizeof(buffer) - strlen(CARRIAGE_RETURN_NEWLINE), message, data_points);
   va_end(data_points);
-  usart_write_simple(buffer);
+  strcat(buffer, CARRIAGE_RETURN_NEWLINE);
+  if(!usart_line_fits(strlen(buffer))){
+    return;
+  }
+  hal_serial_write((uint8_t *)buffer, strlen(buffer));
 }
 
 /*
@@ -69,7 +107,7 @@ void usart_write_data_string(char *message, ...){
   Output: Returns the output of the USART_Read function
 */
 char usart_read_simple(){
-  return USART_Read(USART2);
+  return hal_serial_read();
 }
 
 /*
@@ -79,7 +117,23 @@ char usart_read_simple(){
   Output: Returns the output of the USART_Read function
 */
 char usart_read_no_block(void){
-	return USART_Read_No_Block(USART2);
+	return hal_serial_read_no_block();
+}
+
+/*
+  Helper function to check for input without reading it
+
+  Output: Returns 1 if a character is waiting to be read, 0 otherwise
+*/
+int usart_data_available(void){
+	return hal_serial_data_available();
+}
+
+/*
+  Helper function to hand queued output to the UART, run by the TX drain task
+*/
+void usart_tx_drain(void){
+	hal_serial_tx_drain();
 }
 
 /*
@@ -2,7 +2,7 @@
   Header file for the USART helper functions
 */
 
-#include "UART.h"
+#include "HAL.h"
 #include "CONSTANTS.h"
 
 #include <string.h>
@@ -17,6 +17,15 @@
 */
 void usart_write_simple(char *message);
 
+/*
+  This function picks what a write does when the TX buffer has no room for it.
+  Waiting holds up every other task until the console catches up, so output
+  nobody is waiting on drops whole lines instead
+
+  Input: when_full - USART_WAIT_WHEN_FULL or USART_DROP_WHEN_FULL
+*/
+void usart_write_when_full(int when_full);
+
 /*
   This function helps the user to see what they are typing into the console
 
@@ -52,6 +61,18 @@ char usart_read_simple(void);
 */
 char usart_read_no_block(void);
 
+/*
+  Helper function to check for input without reading it
+
+  Output: Returns 1 if a character is waiting to be read, 0 otherwise
+*/
+int usart_data_available(void);
+
+/*
+  Helper function to hand queued output to the UART, run by the TX drain task
+*/
+void usart_tx_drain(void);
+
 /*
 	This helper function wraps the real time write function and prints out
 	the terminal character the user should see
@@ -1,15 +1,42 @@
 #include "stm32l476xx.h"
 #include "SysClock.h"
 #include "LED.h"
-#include "helper.h"
+#include "UART.h"
+#include "Helper.h"
 #include "GPIO.h"
 #include "TIMER.h"
+#include "TRAJECTORY.h"
+#include "SOFT_PWM.h"
+#include "TIMING_WHEEL.h"
+#include "POWER.h"
+#include "DELAY.h"
+#include "SCHEDULER.h"
+#include "LINE_EDITOR.h"
+#include "EMERGENCY_STOP.h"
+#include "HAL.h"
+#include "TRACE.h"
+#include "BENCHMARK.h"
+#include "COUNTERS.h"
+#include "STACK.h"
+#include "RECIPE_TRACE.h"
 
 // Constant declarations
-servo_data motors[NUMBER_OF_SERVOS];														// Contains information on the various motor metrics
+INSTANCE servo_data motors[NUMBER_OF_SERVOS + SCRATCH_SLOTS];													// Contains information on the various motor metrics
+INSTANCE line_editor console_line;																				// The command line being typed in
+INSTANCE char command_queue[COMMAND_QUEUE_SIZE][COMMAND_LINE_SIZE + 1];	// Finished command lines waiting for the dispatcher
+INSTANCE int command_queue_read = 0;																			// The next command line the dispatcher runs
+INSTANCE int command_queue_write = 0;																		// Where the console puts the next finished command line
+INSTANCE int recipes_running = 0;																				// Set while any recipe started from the console is still going
+INSTANCE int telemetry_enabled = TELEMETRY_DEFAULT;											// Set while the telemetry frames are turned on
+INSTANCE uint32_t telemetry_deadline;																		// When the next telemetry frame is due
+INSTANCE wheel_timer telemetry_timer;																		// Wakes the telemetry task every period
+INSTANCE uint32_t glide_requested = GLIDE_NONE;													// The servos the command set being run told to glide
+#ifdef BENCHMARK_AT_BOOT
+INSTANCE benchmark_result benchmark_results[MAX_BENCHMARKS];								// What the boot benchmarks measured
+#endif
 
 // Define a multidemensional array to contain every recipe
-int recipes[NUMBER_OF_RECIPES][MAX_RECIPE_SIZE] = {
+INSTANCE int recipes[NUMBER_OF_RECIPES + SCRATCH_SLOTS][MAX_RECIPE_SIZE] = {
 	
 	// Recipe 0 is the test recipe given by the instructor
 	{ 
@@ -84,7 +111,400 @@ int recipes[NUMBER_OF_RECIPES][MAX_RECIPE_SIZE] = {
 };
 
 /*
-  This funciton processes the input derived from the get_user_input function
+	The timing wheel runs this every telemetry period to wake the telemetry task
+	
+	Input:
+		context - Not used
+*/
+static void telemetry_tick(void *context){
+	telemetry_deadline += TELEMETRY_PERIOD * TICKS_PER_MILLISECOND;
+	timing_wheel_schedule(&telemetry_timer, telemetry_deadline, telemetry_tick, NULL);
+	task_signal(TASK_TELEMETRY, TASK_EVENT_PERIOD);
+}
+
+/*
+	This function turns the telemetry frames on or off.  The timer only runs while
+	they are on, so they cost nothing otherwise
+
+	Input:
+		enable - TELEMETRY_ON or TELEMETRY_OFF
+*/
+void telemetry_enable(int enable){
+	telemetry_enabled = enable;
+	if(enable){
+		telemetry_deadline = now();
+		telemetry_tick(NULL);
+	}
+	else {
+		timing_wheel_cancel(&telemetry_timer);
+	}
+}
+
+/*
+	This function prints the state of one servo, for the status query and telemetry
+
+	Input:
+		servo_index - The servo to print
+*/
+void print_servo_status(int servo_index){
+	usart_write_data_string("Servo %d: status %d position %d recipe %d instruction %d next %d faults %d (%s)",
+		servo_index, motors[servo_index].status, motors[servo_index].position,
+		motors[servo_index].recipe_index, motors[servo_index].recipe_instruction_index,
+		motors[servo_index].shadow_recipe_index,
+		motors[servo_index].fault_count, fault_policy_name(motors[servo_index].fault_policy));
+}
+
+/*
+	The telemetry task prints a frame with the state of every servo in use
+	
+	Input:
+		events  - The TASK_EVENT flags that woke the task up
+		context - Not used
+*/
+void telemetry_task(uint32_t events, void *context){
+	if(!telemetry_enabled){
+		return;
+	}
+
+	// A frame is longer than the TX buffer, so lines that do not fit are dropped
+	// rather than holding up the recipes until the console catches up
+	usart_write_when_full(USART_DROP_WHEN_FULL);
+	usart_write_simple("");
+	for(int servo_index = 0; servo_index < NUMBER_OF_SERVOS; servo_index++){
+		if(servo_in_use(servo_index, motors)){
+			print_servo_status(servo_index);
+		}
+	}
+	usart_write_data_string("Idle for %d%% of the time", idle_percentage());
+	usart_write_data_string("Worst emergency stop %d cycles", emergency_stop_worst_reaction_cycles());
+	usart_write_data_string("Stack %u of %u bytes at most", stack_high_water(), stack_size());
+	counters_print();
+	usart_write_when_full(USART_WAIT_WHEN_FULL);
+}
+
+/*
+	This function shows what the servos are doing on the LEDs, the red LED is on
+	while a recipe is running or any servo is still moving.  The green LED stays on,
+	the console always takes input
+*/
+void status_leds_update(){
+	int moving = recipes_running;
+
+	for(int servo_index = 0; servo_index < NUMBER_OF_SERVOS; servo_index++){
+		if(!motors[servo_index].deadline_expired){
+			moving = 1;
+		}
+	}
+	if(moving){
+		hal_led_red(1);
+	}
+	else {
+		hal_led_red(0);
+	}
+}
+
+/*
+	The command handlers, one per console letter.  Each one runs the command on
+	one servo, the command table below picks the handler for each typed byte
+
+	Input:
+		index - The servo the command is for
+*/
+void command_begin(int index){
+
+	// Make sure we keep track of the motor status here
+	// Also reset the recipe index, since 'B' should always start at the beginning
+	fixup_servo_data(index, &motors[index], RESTART);
+	motors[index].status = active;
+}
+
+void command_continue(int index){
+
+	// Make sure we keep track of the motor status here, a servo the fault policy
+	// gave up on gets its full run of restarts back
+	motors[index].status = active;
+	motors[index].recipe_status = idle;
+	motors[index].fault_restarts = FAULT_RESTARTS_DEFAULT;
+}
+
+void command_left(int index){
+	uint16_t target_position = motors[index].position - 1;
+
+	// Moving a servo by hand in the middle of its recipe would throw off its timeline
+	if(motors[index].status == active){
+		usart_write_simple("");
+		usart_write_data_string("Servo %d is running a recipe, pause it before moving it", index);
+	}
+	else if(motors[index].position != zero_degrees) {
+		move_servo(index, &motors[index], target_position, NON_RECIPE_MOVE);
+	}
+	else {
+		usart_write_simple("");
+		usart_write_data_string("Cannot move motor %d any more leftward, it is already at the max lefthand position", index);
+	}
+}
+
+void command_right(int index){
+	uint16_t target_position = motors[index].position + 1;
+
+	// Moving a servo by hand in the middle of its recipe would throw off its timeline
+	if(motors[index].status == active){
+		usart_write_simple("");
+		usart_write_data_string("Servo %d is running a recipe, pause it before moving it", index);
+	}
+	else if(motors[index].position != one_hundred_and_sixty_degrees) {
+		move_servo(index, &motors[index], target_position, NON_RECIPE_MOVE);
+	}
+	else {
+		usart_write_simple("");
+		usart_write_data_string("Cannot move motor %d more rightward, it is already at the max righthand position", index);
+	}
+}
+
+void command_glide(int index){
+
+	// The glide plays every TIM2 channel, so it would hold a servo running a recipe still
+	for(int servo_index = 0; servo_index < TRAJECTORY_FRAME_SIZE; servo_index++){
+		if(motors[servo_index].status == active){
+			usart_write_simple("");
+			usart_write_data_string("Servo %d is running a recipe, pause it before gliding", servo_index);
+			return;
+		}
+	}
+	if(trajectory_active()){
+		usart_write_simple("");
+		usart_write_simple("A glide is still playing, wait for it to finish");
+	}
+	else if(index >= TRAJECTORY_FRAME_SIZE){
+		usart_write_simple("");
+		usart_write_data_string("Servo %d is on the software PWM, only the TIM2 servos can glide", index);
+	}
+	else {
+
+		// Every servo of the command set glides together, once the whole set is read
+		glide_requested |= (1 << index);
+	}
+}
+
+void command_nothing(int index){
+
+	// Do nothing
+}
+
+void command_pause(int index){
+
+	// Make sure we keep track of the motor status here, a running recipe is paused
+	// where it is so 'C' picks it back up
+	if(motors[index].status == active){
+		usart_write_simple("");
+		usart_write_data_string("Pausing recipe execution on servo %d ...", index);
+		motors[index].status = paused;
+	}
+}
+
+void command_fault_policy(int index){
+
+	// Move on to the next fault policy for the servo
+	cycle_fault_policy(index, &motors[index]);
+}
+
+void command_hot_swap(int index){
+	int recipe_index = motors[index].shadow_recipe_index;
+
+	// Load the recipe after the one that would run next, so pressing it again keeps going
+	if(recipe_index == NO_RECIPE){
+		recipe_index = motors[index].recipe_index;
+	}
+	usart_write_simple("");
+	recipe_load_shadow(index, &motors[index], (recipe_index + 1) % NUMBER_OF_RECIPES);
+}
+
+void command_status(int index){
+
+	// Query the state of the servo
+	usart_write_simple("");
+	print_servo_status(index);
+}
+
+void command_telemetry(int index){
+
+	// Turn the telemetry frames on or off
+	telemetry_enable(!telemetry_enabled);
+}
+
+void command_trace(int index){
+
+	// Start or stop the waveform trace capture
+	trace_enable(!trace_enabled);
+}
+
+void command_self_test(int index){
+
+	// Check how the board is performing
+	benchmark_self_test();
+}
+
+void command_counters(int index){
+
+	// Show what the controller has been doing
+	usart_write_simple("");
+	counters_print();
+}
+
+void command_stack(int index){
+
+	// Show how close the stack has come to overflowing
+	benchmark_stack_print();
+}
+
+void command_recipe_trace(int index){
+
+	// Dump every recipe instruction the ring still holds
+	usart_write_simple("");
+	recipe_trace_print(RECIPE_TRACE_ALL);
+}
+
+/*
+	The command table has one entry for every byte that can be typed.  It says what
+	kind of byte it is and, for the servo letters, which handler runs it.  The line
+	editor, the command set parser, process_user_input and the emergency stop check
+	in the RX interrupt all look bytes up here, so sorting a byte out is one array
+	index.  Bytes above 0x7F are left out of the list, which makes them
+	COMMAND_FLAG_NONE
+*/
+const command_entry command_table[COMMAND_TABLE_SIZE] = {
+	{NULL, COMMAND_FLAG_NONE},                                    // NUL
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x01
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x02
+	{NULL, COMMAND_FLAG_STOP},                                    // ETX
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x04
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x05
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x06
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x07
+	{NULL, COMMAND_FLAG_NONE},                                    // BS
+	{NULL, COMMAND_FLAG_NONE},                                    // TAB
+	{NULL, COMMAND_FLAG_NONE},                                    // LF
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x0B
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x0C
+	{NULL, COMMAND_FLAG_NEWLINE},                                 // CR
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x0E
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x0F
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x10
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x11
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x12
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x13
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x14
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x15
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x16
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x17
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x18
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x19
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x1A
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x1B
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x1C
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x1D
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x1E
+	{NULL, COMMAND_FLAG_NONE},                                    // 0x1F
+	{NULL, COMMAND_FLAG_DELIMITER},                               // space
+	{NULL, COMMAND_FLAG_NONE},                                    // '!'
+	{NULL, COMMAND_FLAG_NONE},                                    // '"'
+	{NULL, COMMAND_FLAG_NONE},                                    // '#'
+	{NULL, COMMAND_FLAG_NONE},                                    // '$'
+	{NULL, COMMAND_FLAG_NONE},                                    // '%'
+	{NULL, COMMAND_FLAG_NONE},                                    // '&'
+	{NULL, COMMAND_FLAG_NONE},                                    // '''
+	{NULL, COMMAND_FLAG_NONE},                                    // '('
+	{NULL, COMMAND_FLAG_NONE},                                    // ')'
+	{NULL, COMMAND_FLAG_NONE},                                    // '*'
+	{NULL, COMMAND_FLAG_NONE},                                    // '+'
+	{NULL, COMMAND_FLAG_DELIMITER},                               // ','
+	{NULL, COMMAND_FLAG_NONE},                                    // '-'
+	{NULL, COMMAND_FLAG_NONE},                                    // '.'
+	{NULL, COMMAND_FLAG_NONE},                                    // '/'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '0'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '1'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '2'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '3'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '4'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '5'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '6'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '7'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '8'
+	{NULL, COMMAND_FLAG_DIGIT},                                   // '9'
+	{NULL, COMMAND_FLAG_FIRST_SERVO},                             // ':'
+	{NULL, COMMAND_FLAG_DELIMITER},                               // ';'
+	{NULL, COMMAND_FLAG_NONE},                                    // '<'
+	{NULL, COMMAND_FLAG_NONE},                                    // '='
+	{NULL, COMMAND_FLAG_NONE},                                    // '>'
+	{NULL, COMMAND_FLAG_NONE},                                    // '?'
+	{NULL, COMMAND_FLAG_NONE},                                    // '@'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'A'
+	{command_begin, COMMAND_FLAG_SERVO | COMMAND_FLAG_RECIPE},    // 'B'
+	{command_continue, COMMAND_FLAG_SERVO | COMMAND_FLAG_RECIPE}, // 'C'
+	{command_recipe_trace, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE}, // 'D'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'E'
+	{command_fault_policy, COMMAND_FLAG_SERVO},                   // 'F'
+	{command_glide, COMMAND_FLAG_SERVO},                          // 'G'
+	{command_hot_swap, COMMAND_FLAG_SERVO},                        // 'H'
+	{command_counters, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},   // 'I'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'J'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'K'
+	{command_left, COMMAND_FLAG_SERVO},                           // 'L'
+	{command_stack, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},      // 'M'
+	{command_nothing, COMMAND_FLAG_SERVO},                        // 'N'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'O'
+	{command_pause, COMMAND_FLAG_SERVO},                          // 'P'
+	{command_self_test, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},  // 'Q'
+	{command_right, COMMAND_FLAG_SERVO},                          // 'R'
+	{command_status, COMMAND_FLAG_SERVO},                         // 'S'
+	{command_telemetry, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},  // 'T'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'U'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'V'
+	{command_trace, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},      // 'W'
+	{NULL, COMMAND_FLAG_CANCEL},                                  // 'X'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'Y'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'Z'
+	{NULL, COMMAND_FLAG_NONE},                                    // '['
+	{NULL, COMMAND_FLAG_NONE},                                    // '\'
+	{NULL, COMMAND_FLAG_NONE},                                    // ']'
+	{NULL, COMMAND_FLAG_NONE},                                    // '^'
+	{NULL, COMMAND_FLAG_NONE},                                    // '_'
+	{NULL, COMMAND_FLAG_NONE},                                    // '`'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'a'
+	{command_begin, COMMAND_FLAG_SERVO | COMMAND_FLAG_RECIPE},    // 'b'
+	{command_continue, COMMAND_FLAG_SERVO | COMMAND_FLAG_RECIPE}, // 'c'
+	{command_recipe_trace, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE}, // 'd'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'e'
+	{command_fault_policy, COMMAND_FLAG_SERVO},                   // 'f'
+	{command_glide, COMMAND_FLAG_SERVO},                          // 'g'
+	{command_hot_swap, COMMAND_FLAG_SERVO},                        // 'h'
+	{command_counters, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},   // 'i'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'j'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'k'
+	{command_left, COMMAND_FLAG_SERVO},                           // 'l'
+	{command_stack, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},      // 'm'
+	{command_nothing, COMMAND_FLAG_SERVO},                        // 'n'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'o'
+	{command_pause, COMMAND_FLAG_SERVO},                          // 'p'
+	{command_self_test, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},  // 'q'
+	{command_right, COMMAND_FLAG_SERVO},                          // 'r'
+	{command_status, COMMAND_FLAG_SERVO},                         // 's'
+	{command_telemetry, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},  // 't'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'u'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'v'
+	{command_trace, COMMAND_FLAG_SERVO | COMMAND_FLAG_ONCE},      // 'w'
+	{NULL, COMMAND_FLAG_CANCEL},                                  // 'x'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'y'
+	{NULL, COMMAND_FLAG_NONE},                                    // 'z'
+	{NULL, COMMAND_FLAG_NONE},                                    // '{'
+	{NULL, COMMAND_FLAG_NONE},                                    // '|'
+	{NULL, COMMAND_FLAG_NONE},                                    // '}'
+	{NULL, COMMAND_FLAG_NONE},                                    // '~'
+	{NULL, COMMAND_FLAG_BACKSPACE}                                // DEL
+};
+
+/*
+  This funciton processes a command set finished by the line editor
 
 	Input: 
 		commands - An array that holds the commands issued to the motor
@@ -93,431 +513,497 @@ int recipes[NUMBER_OF_RECIPES][MAX_RECIPE_SIZE] = {
 		recipe_command_entered - 0 if no recipe command was entered, 1 if one was
 */
 int process_user_input(char commands[COMMAND_BUFFER_SIZE]){
-	int move_command_entered = 0;
+	const command_entry *command;
 	int recipe_command_entered = 0;
 	int already_printed_warning = 0;
-	int restart = 0;
-	uint16_t target_position;
-	uint16_t current_delay_time = 0;
+	int already_ran;
 	
 	// Figure out the command for each motor, the first command is for the
-	// first motor, the second for the second motor
+	// first motor, the second for the second motor.  A set can stop before the
+	// last servo, the servos after it are left alone
 	for(int index = 0; index < NUMBER_OF_SERVOS; index++){
+		if((index > 0) && (commands[index] == '\0')){
+			break;
+		}
+		command = &command_table[(uint8_t)commands[index]];
+
+		// Invalid input, let the user know, but only let them know once
+		if(!(command->flags & COMMAND_FLAG_SERVO)){
+			if(!already_printed_warning){
+				usart_write_simple("");
+				usart_write_data_string("Invalid command set: '%s', please try again", commands);
+				already_printed_warning = 1;
+			}
+			continue;
+		}
 
-		switch(commands[index]){
-			case 'B':
-			case 'b':
-
-				// Make sure we keep track of the motor status here
-				// Also reset the recipe index, since 'B' should always start at the beginning
-				fixup_servo_data(index, &motors[index], RESTART);
-				current_delay_time = MAX_DELAY;
-				motors[index].status = active;
-				recipe_command_entered = 1;
-				restart = 1;
-				break;
-			case 'C':
-			case 'c':
-
-				// Make sure we keep track of the motor status here
-				motors[index].status = active;
-				motors[index].recipe_status = idle;
-				recipe_command_entered = 1;
-				break;
-			case 'L':
-			case 'l':
-				target_position = motors[index].position - 1;
-				if(motors[index].position != zero_degrees) {
-					current_delay_time = move_servo(index, &motors[index], target_position, NON_RECIPE_MOVE);
-					move_command_entered = 1;
-				}
-				else {
-					usart_write_simple("");
-					usart_write_data_string("Cannot move motor %d any more leftward, it is already at the max lefthand position", index);
-				}
-				break;
-			case 'N':
-			case 'n':
-
-				// Do nothing
-				break;
-			case 'P':
-			case 'p':
-
-				// Make sure we keep track of the motor status here
-				motors[index].status = inactive;
-				break;
-
-			case 'R':
-			case 'r':
-				target_position = motors[index].position + 1;
-				if(motors[index].position != one_hundred_and_sixty_degrees) {
-					current_delay_time = move_servo(index, &motors[index], target_position, NON_RECIPE_MOVE);
-					move_command_entered = 1;
+		// Some commands are for the whole board, so only run them once a set
+		if(command->flags & COMMAND_FLAG_ONCE){
+			already_ran = 0;
+			for(int earlier = 0; earlier < index; earlier++){
+				if(command_table[(uint8_t)commands[earlier]].handler == command->handler){
+					already_ran = 1;
 				}
-				else {
-					usart_write_simple("");
-					usart_write_data_string("Cannot move motor %d more rightward, it is already at the max righthand position", index, target_position);
-				}
-				break;
-			default:
+			}
+			if(already_ran){
+				continue;
+			}
+		}
 
-				// Invalid input, let the user know, but only let them know once
-				if(!already_printed_warning){
-					usart_write_simple("");
-					usart_write_data_string("Invalid command set: '%s', please try again", commands);
-					already_printed_warning = 1;
-					recipe_command_entered = 0;
-					restart = 0;
-					move_command_entered = 0;
-				}
+		command->handler(index);
+		if(command->flags & COMMAND_FLAG_RECIPE){
+			recipe_command_entered = 1;
 		}
 	}
 
-	// If the motor is moved, make sure we delay appropriately (this uses the blocking method because single moves
-	// can block)
-	if(move_command_entered || restart){
-		Green_LED_Off();
-		Red_LED_On();
-		delay(current_delay_time);
-		Red_LED_Off();
-		Green_LED_On();
+	// Start the glide for every servo the command set told to glide
+	if(glide_requested != GLIDE_NONE){
+		glide_servos(motors, glide_requested);
+		glide_requested = GLIDE_NONE;
 	}
+
+	// Moves are not waited on, each servo's deadline says when it is done
+	status_leds_update();
 	return recipe_command_entered;
 }
 
 /*
-	This function handles getting input from the user for the command set.
-	Command sets can be any combination of the two letters LlRrPpNnCc or Bb.
-	The letter X or x resets the input, backspace is interpreted and used to
-	move the cursor backwards as expected
+	This function prints the prompt for the next command set
+*/
+void print_prompt(){
+	usart_write_simple("Enter a command set or 'Cc' to continue a recipe:");
+	usart_terminal_character_simple();
+}
+
+/*
+	This funciton runs the next instruction of the recipe on one servo.  It never
+	waits, a move or a wait is started and then checked again once the servo's
+	deadline passes
+
+	Input:
+		servo_index - The servo to run the recipe on
 
 	Output:
-		recipe_command_entered - An integer describing if the user entered in
-														 a command having to do with a recipe
+		1 if the servo can run its next instruction straight away, 0 if it is waiting
 */
-int get_user_input(){
-	int index, first = 0;
-	int recipe_command_entered = 0;
-	char input = NULL;
-	char command_buffer[COMMAND_BUFFER_SIZE + 1] = {NULL, NULL, NULL};
+int recipe_step(int servo_index){
+	int keep_going = 0;
 
-	// Print our banner
-	usart_write_simple("Enter a command set or 'Cc' to continue a recipe:");
-	usart_terminal_character_simple();
-	input = usart_read_simple();
+	// A recipe that fills the whole array ends there even without a RECIPE_END
+	if(motors[servo_index].recipe_instruction_index >= MAX_RECIPE_SIZE){
+		if(!recipe_swap_shadow(servo_index, &motors[servo_index])){
+			fixup_servo_data(servo_index, &motors[servo_index], NO_RESTART);
+		}
+		return SUCCESS;
+	}
+
+	// Get the current instruction object from the recipe
+	current_instruction instruction = get_instruction(recipes[motors[servo_index].recipe_index][motors[servo_index].recipe_instruction_index]);
+	if(motors[servo_index].recipe_status == idle){
+		counters.servos[servo_index].instructions++;
+		recipe_trace_record(servo_index, motors[servo_index].recipe_index, motors[servo_index].recipe_instruction_index,
+			recipes[motors[servo_index].recipe_index][motors[servo_index].recipe_instruction_index]);
+	}
+
+	// Perform all of the opcodes
+	switch(instruction.opcode){
+		
+		// Servo movement
+		case MOV:
+
+			// The instruction is in bounds
+			if(instruction_in_bounds(instruction)){
+				
+				// Start the move if we are idle
+				if(motors[servo_index].recipe_status == idle){
+					move_servo(servo_index, &motors[servo_index], instruction.parameter, RECIPE_MOVE);
+					counters.servos[servo_index].moves++;
+
+					// Keep track of if we are running or not
+					motors[servo_index].recipe_status = running;
+				}
+				
+				// Check if the servo is still moving
+				if(motors[servo_index].recipe_status == running){
+					if(servo_ready(servo_index, motors)){
+						motors[servo_index].recipe_status = idle;
+
+						// We performed an action, increment the counter in the motor data in case we a pause
+						motors[servo_index].recipe_instruction_index++;
+					}
+				}
+			}
+
+			// If the instruction is out of bounds it is a fault
+			else{
+				usart_write_simple("");
+				usart_write_data_string("ERROR: Current instruction parameter out of bounds "BYTE_TO_BINARY_PATTERN, BYTE_TO_BINARY(instruction.parameter));
+				
+				// Apply the servo's fault policy, if it skips the instruction, increment the recipe instruction
+				keep_going = handle_recipe_fault(servo_index, &motors[servo_index]);
+				if(keep_going){
+					motors[servo_index].recipe_instruction_index++;
+				}
+			}
+			break;
 
-	// Only accept two inputs before moving on
-	while(input != ASCII_NEWLINE){
+		// Delay by a number of 1/10 of a seconds
+		case WAIT:
+			
+			// Start the wait if we are idle
+			if(motors[servo_index].recipe_status == idle){
 
-		// Check if the user entered an X first, if they did, then we have 
-		// to write that out and break out of getting input
-		if(check_for_valid_input(&input, VALID_X)){ 
-			usart_real_time_write(input, PRINT_NEWLINE);
-			usart_terminal_character_simple();
-			return recipe_command_entered;
-		};
+				// Delay the appropriate amount of time
+				schedule_servo_deadline(&motors[servo_index], now(), RECIPE_SERVO_DELAY * instruction.parameter);
+				counters.servos[servo_index].waits++;
 
-		// Next handle when the user enters a backspace
-		if(input == ASCII_BACKSPACE){
+				// Keep track of if we are running or not
+				motors[servo_index].recipe_status = running;
+			}
+			
+			// Check if we need to wait more
+			if(motors[servo_index].recipe_status == running){
 
-			// If the user enetered in a backspace, reverse the input index by 1
-			if(index > first){
-				index--;
+				if(servo_ready(servo_index, motors)){
+					motors[servo_index].recipe_status = idle;
 
-				// Write out the backspace
-				usart_real_time_write(input, NO_NEWLINE);
+					// We performed an action, increment the counter in the motor data in case we a pause
+					motors[servo_index].recipe_instruction_index++;
+				}
 			}
-		} 
+			break;
 
-		// Now store the character unless its a backspace and move on
-		else {
+		// Indicate that we are looping instructions
+		case LOOP:
 
-			// Don't record out of bounds inputs
-			if(index >= COMMAND_BUFFER_SIZE){
-				break; 
+			// This is an error, do not accept loops inside loops
+			if(motors[servo_index].inside_recipe_loop == INSIDE_RECIPE_LOOP){ 
+				usart_write_simple("");
+				usart_write_data_string("ERROR: Current instruction parameter indicates nested loops "BYTE_TO_BINARY_PATTERN, BYTE_TO_BINARY(instruction.parameter));
+
+				// Apply the servo's fault policy, if it skips the instruction, increment the recipe instruction
+				keep_going = handle_recipe_fault(servo_index, &motors[servo_index]);
+				if(keep_going){
+					motors[servo_index].recipe_instruction_index++;
+					motors[servo_index].inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
+				}
 			}
+			else{
 
-			// Store our character
-			command_buffer[index] = input;
+				// Recipe instruction index increments here as well
+				motors[servo_index].recipe_instruction_index++;
+				motors[servo_index].inside_recipe_loop = INSIDE_RECIPE_LOOP;
+				motors[servo_index].recipe_loop_index = motors[servo_index].recipe_instruction_index;
+				motors[servo_index].recipe_loop_count = instruction.parameter - RECIPE_LOOP_MODIFIER;
+			}
+			break;
 
-			// Move on to the next character
-			index++;
+		// Indicate that we are at the end of the loop section
+		case END_LOOP:
+			
+			// check if we are in a loop, if not then we have found an error and need to quit
+			if(motors[servo_index].inside_recipe_loop != INSIDE_RECIPE_LOOP){ 
+				usart_write_simple("");
+				usart_write_data_string("ERROR: Current instruction parameter indicates nested loops "BYTE_TO_BINARY_PATTERN, BYTE_TO_BINARY(instruction.parameter));
+
+				// Apply the servo's fault policy, if it skips the instruction, increment the recipe instruction
+				keep_going = handle_recipe_fault(servo_index, &motors[servo_index]);
+				if(keep_going){
+					motors[servo_index].recipe_instruction_index++;
+					motors[servo_index].inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
+				}
+			} 
+			// The end of each pass through the loop is a boundary where a recipe waiting
+			// in the shadow slot takes over
+			else if(recipe_swap_shadow(servo_index, &motors[servo_index])){
+				break;
+			}
+			else{
+				
+				// This section indicates the end of the loop
+				if(motors[servo_index].recipe_loop_count < LOOP_END_COUNT){
+					
+					motors[servo_index].inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
+					motors[servo_index].recipe_instruction_index++;
+				}
 
-			// Write out our character
-			usart_real_time_write(input, NO_NEWLINE);
-		}
+				// If we are still in the loop, then move back to the first index
+				else {
+
+					motors[servo_index].recipe_instruction_index = motors[servo_index].recipe_loop_index;
+					counters.servos[servo_index].loops++;
+
+					// Decrement our counter.  When this reaches below 0 we stop looping
+					motors[servo_index].recipe_loop_count--;
+				}
+			}
+			break;
+
+		// The end of the recipe
+		case RECIPE_END:
+
+			// Change over to the shadow recipe if one is waiting, otherwise reset our
+			// stats back to expected positions
+			if(!recipe_swap_shadow(servo_index, &motors[servo_index])){
+				fixup_servo_data(servo_index, &motors[servo_index], NO_RESTART);
+			}
+
+			break;
 
-		// Read again at the end
-		input = usart_read_simple();
+		// Invalid command found
+		default:
+			usart_write_data_string("Invalid recipe command encountered "BYTE_TO_BINARY_PATTERN, BYTE_TO_BINARY(instruction.opcode));
+			
+			// Apply the servo's fault policy, if it skips the instruction, increment the recipe instruction
+			keep_going = handle_recipe_fault(servo_index, &motors[servo_index]);
+			if(keep_going){
+				motors[servo_index].recipe_instruction_index++;
+			}
+			break;
 	}
-	
-	// Now that the input has been found and processed, process it into motor movements
-	recipe_command_entered = process_user_input(command_buffer);
-	usart_write_simple("");
-	return recipe_command_entered;
+
+	// Only a move or a wait that is still going leaves the servo running
+	return (motors[servo_index].recipe_status == idle);
+}
+
+/*
+	This function prints the recipe summary once the last running recipe has
+	finished or been paused
+*/
+void recipes_check_finished(){
+	if(recipes_running && !any_servo_active(motors)){
+		recipes_running = 0;
+		usart_write_simple("Recipe execution completed");
+		usart_write_data_string("Idle for %d%% of recipe execution", idle_percentage());
+	}
+	status_leds_update();
 }
 
 /*
-	This funciton handles reading in the recipe and processing the commands included in
-	each recipe
+	This function starts the recipe task of every servo the console set active
 */
-void process_recipe_no_block(){
+void recipes_start(){
 	usart_write_simple("");
 	usart_write_simple("Processing recipes ...");
-	int recipe_ended = 0;
-	int keep_going = 0;
-	int servos_paused = 0;
-	char pause = NULL;
 
-	// We need to iterate through each item in each recipe
-	while(1){
-			
-		// Break the recipe processing loop if we paused both servos or if both recipes ended,
-		// or is both servos are inactive, or some mix of the situations
-		if(  (recipe_ended == 2)
-			|| (servos_paused == 2)
-			|| ((servos_paused == 1) && (recipe_ended == 1))
-			|| ((servos_paused == 1) && (some_servo_inactive(motors)))
-			|| (both_servos_inactive_or_paused(motors))){
+	// Measure how much of the recipe execution the core spends asleep, from the first
+	// recipe started until the last one finishes
+	if(!recipes_running){
+		idle_reset_statistics();
+		recipes_running = 1;
+	}
+
+	for(int servo_index = 0; servo_index < NUMBER_OF_SERVOS; servo_index++){
+		if(motors[servo_index].status == active){
+			task_signal(motors[servo_index].task, TASK_EVENT_START);
+		}
+	}
+}
+
+/*
+	The recipe task of one servo.  It runs a few instructions at a time and comes
+	back when the servo's deadline passes, so every servo keeps its own timeline
+
+	Input:
+		events  - The TASK_EVENT flags that woke the task up
+		context - The motor struct refernce of the servo
+*/
+void recipe_task(uint32_t events, void *context){
+	int servo_index = (servo_data *)context - motors;
+	int steps = 0;
+
+	while(motors[servo_index].status == active){
+
+		// A servo that is still moving (from a manual move or a restart) finishes first
+		if((motors[servo_index].recipe_status == idle) && !motors[servo_index].deadline_expired){
+			break;
+		}
+		if(!recipe_step(servo_index)){
 			break;
 		}
 
-		// For each servo perform each action
-		for(int servo_index = 0; servo_index < NUMBER_OF_SERVOS; servo_index++){
-			
-			// The motor has been iussued a recipe command and is active
-			if(motors[servo_index].status == active){
-
-					// Check if the user paused execution, if they did, make both servos inactive, and break
-					// The outer loop will be handled by the servo being inactive
-					pause = usart_read_no_block();
-					if(check_for_valid_input(&pause, VALID_P)){
-						usart_terminal_character_simple();
-						usart_real_time_write(pause, PRINT_NEWLINE);
-						usart_write_data_string("Pausing recipe execution on servo %d ...", servo_index);
-						motors[servo_index].status = paused;
-
-						// Indicate we have paused so that we do not print out the 'Recipe execution completed' message
-						servos_paused += 1;
-						break;
-					}
+		// Let the other tasks in, and come straight back afterwards
+		steps++;
+		if(steps >= RECIPE_STEPS_PER_RUN){
+			task_signal(motors[servo_index].task, TASK_EVENT_CONTINUE);
+			break;
+		}
+	}
+	recipes_check_finished();
+}
+
+/*
+	The console task feeds every byte that has arrived to the line editor, and hands
+	each finished command line to the dispatcher.  It only ever handles the bytes that
+	are already here, so typing never holds up anything else
 
-					// Get the current instruction object from the recipe
-					current_instruction instruction = get_instruction(recipes[motors[servo_index].recipe_index][motors[servo_index].recipe_instruction_index]);
-
-					// Perform all of the opcodes
-					switch(instruction.opcode){
-						
-						// Servo movement
-						case MOV:
-
-							// The instruction is in bounds
-							if(instruction_in_bounds(instruction)){
-								
-								// Start the timer if we are idle
-								if(motors[servo_index].recipe_status == idle){
-									start_timer(servo_index);
-									move_servo(servo_index, &motors[servo_index], instruction.parameter, RECIPE_MOVE);
-
-									// Keep track of if we are running or not
-									motors[servo_index].recipe_status = running;
-								}
-								
-								// Check if the servo is still moving
-								if(motors[servo_index].recipe_status == running){
-									if(servo_ready(servo_index, motors)){
-										stop_timer(servo_index);
-										motors[servo_index].recipe_status = idle;
-
-										// We performed an action, increment the counter in the motor data in case we a pause
-										motors[servo_index].recipe_instruction_index++;
-									}
-								}
-							}
-
-							// If the instruction is out of bounds fail and make the user restart
-							else{
-								usart_write_simple("");
-								usart_write_data_string("ERROR: Current instruction parameter out of bounds "BYTE_TO_BINARY_PATTERN, BYTE_TO_BINARY(instruction.parameter));
-								
-								// Check with the user if they want to keep executing recipes, if so, increment the recipe instruction
-								keep_going = exit_program();
-								if(keep_going){
-									motors[servo_index].recipe_instruction_index++;
-								}
-							}
-							break;
-
-						// Delay by a number of 1/10 of a seconds
-						case WAIT:
-							
-							// Start the timer if we are idle
-							if(motors[servo_index].recipe_status == idle){
-								
-
-								// Delay the appropriate amount of time
-								motors[servo_index].total_delay = RECIPE_SERVO_DELAY * instruction.parameter;
-
-								// Keep track of if we are running or not
-								motors[servo_index].recipe_status = running;
-
-								start_timer(servo_index);
-								uint16_t current_time = get_current_time(servo_index);
-								motors[servo_index].last_start_time = current_time;
-							}
-							
-							// Check if we need to wait more
-							if(motors[servo_index].recipe_status == running){
-
-								if(servo_ready(servo_index, motors)){
-									stop_timer(servo_index);
-									motors[servo_index].recipe_status = idle;
-
-									// We performed an action, increment the counter in the motor data in case we a pause
-									motors[servo_index].recipe_instruction_index++;
-								}
-							}
-							break;
-
-						// Indicate that we are looping instructions
-						case LOOP:
-
-							// This is an error, do not accept loops inside loops
-							if(motors[servo_index].inside_recipe_loop == INSIDE_RECIPE_LOOP){ 
-								usart_write_simple("");
-								usart_write_data_string("ERROR: Current instruction parameter indicates nested loops "BYTE_TO_BINARY_PATTERN, BYTE_TO_BINARY(instruction.parameter));
-
-								// Check with the user if they want to keep executing recipes, if so, increment the recipe instruction
-								keep_going = exit_program();
-								if(keep_going){
-									motors[servo_index].recipe_instruction_index++;
-									motors[servo_index].inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
-								}
-							}
-							else{
-
-								// Recipe instruction index increments here as well
-								motors[servo_index].recipe_instruction_index++;
-								motors[servo_index].inside_recipe_loop = INSIDE_RECIPE_LOOP;
-								motors[servo_index].recipe_loop_index = motors[servo_index].recipe_instruction_index;
-								motors[servo_index].recipe_loop_count = instruction.parameter - RECIPE_LOOP_MODIFIER;
-							}
-							break;
-
-						// Indicate that we are at the end of the loop section
-						case END_LOOP:
-							
-							// check if we are in a loop, if not then we have found an error and need to quit
-							if(motors[servo_index].inside_recipe_loop != INSIDE_RECIPE_LOOP){ 
-								usart_write_simple("");
-								usart_write_data_string("ERROR: Current instruction parameter indicates nested loops "BYTE_TO_BINARY_PATTERN, BYTE_TO_BINARY(instruction.parameter));
-
-								// Check with the user if they want to keep executing recipes, if so, increment the recipe instruction
-								keep_going = exit_program();
-								if(keep_going){
-									motors[servo_index].recipe_instruction_index++;
-									motors[servo_index].inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
-								}
-							} 
-							else{
-								
-								// This section indicates the end of the loop
-								if(motors[servo_index].recipe_loop_count < LOOP_END_COUNT){
-									
-									motors[servo_index].inside_recipe_loop = INSIDE_RECIPE_LOOP_DEFAULT;
-									motors[servo_index].recipe_instruction_index++;
-								}
-
-								// If we are still in the loop, then move back to the first index
-								else {
-
-									motors[servo_index].recipe_instruction_index = motors[servo_index].recipe_loop_index;
-
-									// Decrement our counter.  When this reaches below 0 we stop looping
-									motors[servo_index].recipe_loop_count--;
-								}
-							}
-							break;
-
-						// The end of the recipe
-						case RECIPE_END:
-							recipe_ended += 1;
-
-							// Reset our stats back to expected positions
-							fixup_servo_data(servo_index, &motors[servo_index], NO_RESTART);
-
-							break;
-
-						// Invalid command found
-						default:
-							usart_write_data_string("Invalid recipe command encountered "BYTE_TO_BINARY_PATTERN, BYTE_TO_BINARY(instruction.opcode));
-							
-							// Check with the user if they want to keep executing recipes, if so, increment the recipe instruction
-							keep_going = exit_program();
-							if(keep_going){
-								motors[servo_index].recipe_instruction_index++;
-							}
-							break;
+	Input:
+		events  - The TASK_EVENT flags that woke the task up
+		context - Not used
+*/
+void console_task(uint32_t events, void *context){
+	int next;
+
+	while(usart_data_available()){
+		switch(line_editor_feed(&console_line, usart_read_no_block())){
+			case LINE_EDITOR_DONE:
+
+				// Queue the command line for the dispatcher, unless it is too far behind
+				next = (command_queue_write + 1) % COMMAND_QUEUE_SIZE;
+				if(next != command_queue_read){
+					strcpy(command_queue[command_queue_write], console_line.buffer);
+					command_queue_write = next;
+					task_signal(TASK_DISPATCHER, TASK_EVENT_LINE);
 				}
-			}
+				else {
+					usart_write_simple("");
+					usart_write_data_string("Too many command lines waiting, '%s' was dropped", console_line.buffer);
+				}
+				line_editor_reset(&console_line);
+				break;
+			case LINE_EDITOR_CANCELLED:
+				print_prompt();
+				break;
+			default:
+				break;
 		}
 	}
+}
 
-	// Only fixup the recipe data if the maximum recipe size was reached and we didnt fix it earlier
-	fixup_servo_data_multiple(motors, NO_RESTART);
+/*
+	The dispatcher task runs the command lines the console finished, in the order
+	they were typed in.  Every command set on a line runs back to back, and the
+	prompt only comes back once the whole line is done
 
-	// Only print our status out if we didn't pause
-	if(servos_paused == 2){
-		usart_write_simple("Recipe execution completed");
+	Input:
+		events  - The TASK_EVENT flags that woke the task up
+		context - Not used
+*/
+void dispatcher_task(uint32_t events, void *context){
+	int recipe_command_entered;
+	char command_set[COMMAND_BUFFER_SIZE + 1];
+	char *cursor;
+	int repeat;
+
+	// The RX interrupt already stopped everything, just let the user know
+	if(events & TASK_EVENT_STOP){
+		usart_write_simple("");
+		usart_write_data_string("EMERGENCY STOP: every running servo paused in %d cycles (%d us), worst so far %d cycles (%d us)",
+			emergency_stop_reaction_cycles(), cycles_to_us(emergency_stop_reaction_cycles()),
+			emergency_stop_worst_reaction_cycles(), cycles_to_us(emergency_stop_worst_reaction_cycles()));
+		usart_write_simple("Enter a command set to release the stop");
+		print_prompt();
 	}
 
-	// Now stop the timers from counting
-	stop_timers();
+	while(command_queue_read != command_queue_write){
+
+		// A command set typed after the stop releases it
+		if(emergency_stop_active()){
+			emergency_stop_release();
+			usart_write_simple("");
+			usart_write_simple("Emergency stop released");
+		}
+		recipe_command_entered = 0;
+		cursor = command_queue[command_queue_read];
+		while(command_line_next(&cursor, command_set, &repeat)){
+			for(int count = 0; count < repeat; count++){
+				recipe_command_entered |= process_user_input(command_set);
+			}
+		}
+		command_queue_read = (command_queue_read + 1) % COMMAND_QUEUE_SIZE;
+		usart_write_simple("");
+
+		if(recipe_command_entered){
+			recipes_start();
+		}
+		recipes_check_finished();
+		print_prompt();
+	}
 }
 
 /*
-	The main fucntion runs the main loop, that is:
+	The TX drain task hands queued output to USART2 whenever it has room, and
+	wakes the trace task once all of it is gone
+
+	Input:
+		events  - The TASK_EVENT flags that woke the task up
+		context - Not used
+*/
+void tx_drain_task(uint32_t events, void *context){
+	usart_tx_drain();
+
+	// The trace task holds back frames that do not fit, give it another go now there is room
+	if(trace_enabled && (hal_serial_tx_pending() == 0)){
+		task_signal(TASK_TRACE, TASK_EVENT_TRACE);
+	}
+}
+
+/*
+	The main fucntion sets everything up and hands over to the scheduler, that is:
 		1. Initialize the various timers, clocks, pins, and LED's
-		2. Print the user input banner
-		3. Start the loop, turn the green led on to indicate user input is being
-       gathered
-		4. Gather user input
-		5. Turn the green led off and the red led on to indicate that the recipe
-			 is being processed if the user entered a command having to do with a
-       recipe
-    6. Return to step 3
+		2. Print the user input banner and the first prompt
+		3. Create the tasks, in priority order:
+			 - The TX drain task keeps the UART sending
+			 - One recipe task per servo runs that servo's recipe on its own timeline
+			 - The console task feeds bytes to the line editor as they arrive, the
+			   green LED shows it is ready for input
+			 - The dispatcher task runs each command set the line editor finished
+			 - The telemetry task prints the servo state when it is turned on
+			 - The trace task sends the waveform trace while it is captured
+		4. Run the tasks forever, the red led shows a recipe is being processed
 */
 int main(void){
-	int recipe_command_entered;
+	uint32_t recipe_trace_kept;
 
 	// Initialize!
 	
 	System_Clock_Init();
 	LED_Init();
+	scheduler_init();
 	UART2_Init();
 	gpio_init();
 	timer_init();
-	servo_timers_init();
+	trajectory_init();
+	soft_pwm_init();
+	timebase_init();
+	delay_init();
+	timing_wheel_init();
+	idle_init();
+	counters_init();
+	recipe_trace_kept = recipe_trace_init();
 	servo_data_init(motors);
+	emergency_stop_init(motors);
 
 	// Print our banner, let the user know how to proceed
 	print_banner();
+	if(recipe_trace_kept > 0){
+		usart_write_data_string("The recipe trace kept %u instructions from before the reset, enter 'D' to see them", recipe_trace_kept);
+	}
+	print_prompt();
+	hal_led_green(1);
 
-	// Main loop, process the user input and then execute it.  Show the status with a green
-	// LED indicating user input can be entered, and a red led indicating that the commands are
-	// being excecuted
-	while(1){
-			recipe_command_entered = 0;
-			Green_LED_On();
-			recipe_command_entered = get_user_input();
-			Green_LED_Off();
-
-			// Only process recipes if we got a command to run one 
-			if(recipe_command_entered){
-				Red_LED_On();
-				process_recipe_no_block();
-				Red_LED_Off();
-			}
+	task_create(TASK_TX_DRAIN, tx_drain_task, NULL);
+	for(int servo_index = 0; servo_index < NUMBER_OF_SERVOS; servo_index++){
+		motors[servo_index].task = TASK_RECIPE_SERVO_0 + servo_index;
+		task_create(motors[servo_index].task, recipe_task, &motors[servo_index]);
+	}
+	line_editor_reset(&console_line);
+	task_create(TASK_CONSOLE, console_task, NULL);
+	task_create(TASK_DISPATCHER, dispatcher_task, NULL);
+	task_create(TASK_TELEMETRY, telemetry_task, NULL);
+	task_create(TASK_TRACE, trace_task, NULL);
+	telemetry_enable(TELEMETRY_DEFAULT);
+
+#ifdef BENCHMARK_AT_BOOT
+	// Built as the target benchmark runner, time the hot paths before taking commands
+	benchmark_print(benchmark_results, benchmark_run_all(benchmark_results));
+	print_prompt();
+#endif
+
+	// Anything typed during the banner is waiting for the console already
+	if(usart_data_available()){
+		task_signal(TASK_CONSOLE, TASK_EVENT_RX);
 	}
+	scheduler_run();
+	return 0;
 }
@@ -0,0 +1,458 @@
+/*
+  The fleet file simulates a whole cell of controllers at once, to see how the
+  scheduler, console and telemetry hold up at scale.  Every controller is the full
+  firmware with its own copy of every INSTANCE variable (motors, recipes, the timing
+  wheel, the task table, the virtual peripherals), its own peripheral window and its
+  own stack, and runs as a coroutine that any worker can resume.
+
+  Built with FLEET_BUILD, INSTANCE puts all of that state in the controller_state
+  section.  The workers are processes, so each has a section and a peripheral window
+  address range of its own.  To run a controller a worker maps the controller's part
+  of the peripheral file over the window, copies the controller's image into the
+  section and swaps to the controller's context.  Once the controller sleeps past
+  the end of the epoch it swaps back, and the worker copies the section back into
+  the image.  The contexts, stacks, images and work queues are shared memory mapped
+  before the workers fork, at the same address in every worker, so a controller can
+  carry on in whichever worker takes it next.
+
+  Virtual time moves in lockstep epochs.  At the start of an epoch every controller
+  that is not finished is queued on one of the workers.  A worker that runs out of
+  controllers steals from the other queues.  Once every controller has slept past the
+  end of the epoch the next one starts.  A controller epoch costs two context swaps,
+  an mmap and two copies of the section, and never a kernel thread switch
+
+  Usage: fleet_sim [-n controllers] [-w workers] [-e epoch ms] [-t seconds] [-s stagger us] [script]
+
+  Every controller types the same script (see SIM.c), controller n starting n times
+  the stagger later.  Console output is counted rather than printed
+*/
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SIM.h"
+
+// The INSTANCE section, the linker marks where it starts and ends
+extern uint8_t __start_controller_state[];
+extern uint8_t __stop_controller_state[];
+
+// The controllers and the pool that runs them, in memory every worker shares
+static fleet_controller *fleet_controllers;
+static int fleet_controller_count = FLEET_DEFAULT_CONTROLLERS;
+static fleet_worker *fleet_workers;
+static int fleet_worker_count;
+static fleet_epoch *fleet_epochs;
+
+// The file every controller's peripheral window is a part of, one window after another
+static int fleet_peripherals;
+
+// What every controller is started with
+static double fleet_time_limit = SIM_DEFAULT_TIME_LIMIT;
+static uint32_t fleet_stagger;
+static int fleet_epoch_ms = FLEET_DEFAULT_EPOCH;
+
+// The controller this worker is running and the worker's own context, which the
+// controller swaps back to.  Every worker process has its own copy of both
+static fleet_controller *fleet_self;
+static ucontext_t fleet_worker_context;
+
+/*
+	Helper function that reads the host clock
+
+	Output:
+		Host nanoseconds from an arbitrary start
+*/
+static uint64_t fleet_host_now(){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+/*
+	Helper function that maps memory every worker process sees, at the same address
+
+	Input:
+		size - The bytes to map
+
+	Output:
+		The memory, NULL if it could not be mapped
+*/
+static void *fleet_share(size_t size){
+	void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if(memory == MAP_FAILED){
+		perror("Mapping the shared memory");
+		return NULL;
+	}
+	return memory;
+}
+
+/*
+	This function holds a sleeping controller back until the fleet reaches the epoch
+	its next interrupt falls in
+
+	Input:
+		cycle - The virtual cycle the controller wants to wake up on
+*/
+void fleet_wait_for_epoch(uint64_t cycle){
+	while(cycle > fleet_epochs->end){
+		swapcontext(&fleet_self->context, &fleet_worker_context);
+	}
+}
+
+/*
+	This function takes a finished controller's statistics and hands its worker back
+
+	Input:
+		statistics - What the simulator counted while the controller ran
+*/
+void fleet_controller_finished(sim_statistics *statistics){
+	fleet_self->statistics = *statistics;
+	fleet_self->finished = 1;
+	setcontext(&fleet_worker_context);
+}
+
+/*
+	The start of every controller's coroutine, it boots the firmware, which never returns
+*/
+static void fleet_controller_main(){
+	sim_controller_init(fleet_time_limit, fleet_self->index * fleet_stagger);
+	firmware_main();
+}
+
+/*
+	This function runs one controller up to the end of the epoch, or until it finishes,
+	with its own peripheral window and firmware state in place
+
+	Input:
+		controller - The controller to run
+*/
+static void fleet_run(fleet_controller *controller){
+	size_t size = __stop_controller_state - __start_controller_state;
+
+	if(mmap((void *)(uintptr_t)SIM_PERIPHERAL_BASE, SIM_PERIPHERAL_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		fleet_peripherals, (off_t)controller->index * SIM_PERIPHERAL_SIZE) == MAP_FAILED){
+		perror("Mapping a controller's peripheral window");
+		controller->finished = 1;
+		return;
+	}
+	memcpy(__start_controller_state, controller->state, size);
+	fleet_self = controller;
+	swapcontext(&fleet_worker_context, &controller->context);
+	memcpy(controller->state, __start_controller_state, size);
+}
+
+/*
+	This helper function picks the next controller for a worker, from the back of its
+	own queue or, once that is empty, from the front of another worker's
+
+	Input:
+		worker - The worker looking for something to run
+
+	Output:
+		The controller to run, FLEET_NO_CONTROLLER once every queue is empty
+*/
+static int fleet_take(fleet_worker *worker){
+	fleet_worker *victim;
+	int controller = FLEET_NO_CONTROLLER;
+
+	pthread_mutex_lock(&worker->lock);
+	if(worker->tail > worker->head){
+		worker->tail--;
+		controller = worker->controllers[worker->tail];
+	}
+	pthread_mutex_unlock(&worker->lock);
+	if(controller != FLEET_NO_CONTROLLER){
+		return controller;
+	}
+
+	for(int offset = 1; offset < fleet_worker_count; offset++){
+		victim = &fleet_workers[((worker - fleet_workers) + offset) % fleet_worker_count];
+		pthread_mutex_lock(&victim->lock);
+		if(victim->tail > victim->head){
+			controller = victim->controllers[victim->head];
+			victim->head++;
+		}
+		pthread_mutex_unlock(&victim->lock);
+		if(controller != FLEET_NO_CONTROLLER){
+			worker->steals++;
+			return controller;
+		}
+	}
+	return FLEET_NO_CONTROLLER;
+}
+
+/*
+	The loop of one worker process.  Every epoch it runs controllers one at a time until
+	there are none left anywhere, it never returns
+
+	Input:
+		worker - The worker's fleet_worker
+*/
+static void fleet_worker_main(fleet_worker *worker){
+	int controller_index;
+
+	while(1){
+		pthread_barrier_wait(&fleet_epochs->start);
+		if(!fleet_epochs->running){
+			break;
+		}
+		while((controller_index = fleet_take(worker)) != FLEET_NO_CONTROLLER){
+			fleet_run(&fleet_controllers[controller_index]);
+			worker->runs++;
+		}
+		pthread_barrier_wait(&fleet_epochs->finish);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+/*
+	This helper function queues every controller that is not finished yet, spread
+	evenly over the workers
+
+	Output:
+		The number of controllers queued
+*/
+static int fleet_queue_epoch(){
+	int queued = 0;
+	fleet_worker *worker;
+
+	for(int index = 0; index < fleet_worker_count; index++){
+		fleet_workers[index].head = 0;
+		fleet_workers[index].tail = 0;
+	}
+	for(int index = 0; index < fleet_controller_count; index++){
+		if(!fleet_controllers[index].finished){
+			worker = &fleet_workers[queued % fleet_worker_count];
+			worker->controllers[worker->tail] = index;
+			worker->tail++;
+			queued++;
+		}
+	}
+	return queued;
+}
+
+/*
+	This function prints the totals for the whole fleet
+
+	Input:
+		epochs     - The number of epochs that ran
+		epoch_time - The host nanoseconds all the epochs took, added up
+		epoch_worst - The host nanoseconds the slowest epoch took
+		host_time  - The host nanoseconds the whole run took
+*/
+static void fleet_report(int epochs, uint64_t epoch_time, uint64_t epoch_worst, uint64_t host_time){
+	sim_statistics total = {0};
+	sim_statistics *statistics;
+	uint64_t longest = 0;
+	unsigned long runs_least = (unsigned long)-1;
+	unsigned long runs_most = 0;
+	unsigned long steals = 0;
+	double host_seconds = host_time / 1e9;
+	double controller_seconds;
+
+	for(int index = 0; index < fleet_controller_count; index++){
+		statistics = &fleet_controllers[index].statistics;
+		total.cycles += statistics->cycles;
+		total.pwm_changes += statistics->pwm_changes;
+		total.bytes_out += statistics->bytes_out;
+		total.interrupts += statistics->interrupts;
+		total.commands += statistics->commands;
+		total.command_latency_total += statistics->command_latency_total;
+		if(statistics->command_latency_worst > total.command_latency_worst){
+			total.command_latency_worst = statistics->command_latency_worst;
+		}
+		if(statistics->cycles > longest){
+			longest = statistics->cycles;
+		}
+	}
+	for(int index = 0; index < fleet_worker_count; index++){
+		steals += fleet_workers[index].steals;
+		if(fleet_workers[index].runs < runs_least){
+			runs_least = fleet_workers[index].runs;
+		}
+		if(fleet_workers[index].runs > runs_most){
+			runs_most = fleet_workers[index].runs;
+		}
+	}
+	controller_seconds = (double)total.cycles / (SIM_CYCLES_PER_MICROSECOND * 1000000.0);
+
+	printf("%s\n", DASHES);
+	printf("%d controllers on %d workers, %d epochs of %d ms\n", fleet_controller_count, fleet_worker_count, epochs, fleet_epoch_ms);
+	printf("Simulated %.3f s of fleet time, %.1f controller seconds, in %.3f s\n",
+		(double)longest / (SIM_CYCLES_PER_MICROSECOND * 1000000.0), controller_seconds, host_seconds);
+	printf("Throughput: %.0f controller seconds per second, %.0f interrupts per second\n",
+		controller_seconds / host_seconds, total.interrupts / host_seconds);
+	if(epochs > 0){
+		printf("Epochs: %.1f us average, %.1f us worst on the host\n", epoch_time / 1e3 / epochs, epoch_worst / 1e3);
+	}
+	printf("Console: %lu bytes out, %.1f bytes per controller second\n", total.bytes_out, total.bytes_out / controller_seconds);
+	printf("Servos: %lu pulse width changes\n", total.pwm_changes);
+	if(total.commands > 0){
+		printf("Commands: %lu lines, %.1f us average and %.1f us worst virtual time from enter to the next prompt\n",
+			total.commands, (double)total.command_latency_total / total.commands / SIM_CYCLES_PER_MICROSECOND,
+			(double)total.command_latency_worst / SIM_CYCLES_PER_MICROSECOND);
+	}
+	printf("Workers: %lu to %lu controller epochs each, %lu stolen\n", runs_least, runs_most, steals);
+	printf("%s\n", DASHES);
+}
+
+/*
+	This function sets up the memory the workers share, every controller's context,
+	stack and image of the INSTANCE section, the work queues and the epoch barriers
+
+	Output:
+		SUCCESS if everything was set up, FAILURE otherwise
+*/
+static int fleet_setup(){
+	size_t size = __stop_controller_state - __start_controller_state;
+	pthread_mutexattr_t lock_attributes;
+	pthread_barrierattr_t barrier_attributes;
+	fleet_controller *controller;
+	uint8_t *images;
+	uint8_t *stacks;
+	int *queues;
+
+	fleet_controllers = fleet_share(fleet_controller_count * sizeof(fleet_controller));
+	fleet_workers = fleet_share(fleet_worker_count * sizeof(fleet_worker));
+	fleet_epochs = fleet_share(sizeof(fleet_epoch));
+	images = fleet_share(fleet_controller_count * size);
+	stacks = fleet_share((size_t)fleet_controller_count * FLEET_STACK_SIZE);
+	queues = fleet_share((size_t)fleet_worker_count * fleet_controller_count * sizeof(int));
+	if((fleet_controllers == NULL) || (fleet_workers == NULL) || (fleet_epochs == NULL) ||
+		(images == NULL) || (stacks == NULL) || (queues == NULL)){
+		return FAILURE;
+	}
+
+	// Every peripheral window starts out zero, like the one servo_sim maps, and only the
+	// pages a controller writes are ever backed
+	fleet_peripherals = memfd_create("fleet peripherals", 0);
+	if((fleet_peripherals < 0) || (ftruncate(fleet_peripherals, (off_t)fleet_controller_count * SIM_PERIPHERAL_SIZE) != 0)){
+		perror("Creating the peripheral windows");
+		return FAILURE;
+	}
+
+	// Every controller starts from the section's initial values, on a stack of its own
+	for(int index = 0; index < fleet_controller_count; index++){
+		controller = &fleet_controllers[index];
+		controller->index = index;
+		controller->state = images + (index * size);
+		memcpy(controller->state, __start_controller_state, size);
+		getcontext(&controller->context);
+		controller->context.uc_stack.ss_sp = stacks + ((size_t)index * FLEET_STACK_SIZE);
+		controller->context.uc_stack.ss_size = FLEET_STACK_SIZE;
+		controller->context.uc_link = NULL;
+		makecontext(&controller->context, fleet_controller_main, 0);
+	}
+
+	pthread_mutexattr_init(&lock_attributes);
+	pthread_mutexattr_setpshared(&lock_attributes, PTHREAD_PROCESS_SHARED);
+	for(int index = 0; index < fleet_worker_count; index++){
+		fleet_workers[index].controllers = queues + ((size_t)index * fleet_controller_count);
+		pthread_mutex_init(&fleet_workers[index].lock, &lock_attributes);
+	}
+	pthread_barrierattr_init(&barrier_attributes);
+	pthread_barrierattr_setpshared(&barrier_attributes, PTHREAD_PROCESS_SHARED);
+	pthread_barrier_init(&fleet_epochs->start, &barrier_attributes, fleet_worker_count + 1);
+	pthread_barrier_init(&fleet_epochs->finish, &barrier_attributes, fleet_worker_count + 1);
+	fleet_epochs->running = 1;
+	return SUCCESS;
+}
+
+int main(int argc, char *argv[]){
+	FILE *script = stdin;
+	uint64_t epoch_cycles;
+	uint64_t host_start;
+	uint64_t epoch_start;
+	uint64_t epoch_length;
+	uint64_t epoch_time = 0;
+	uint64_t epoch_worst = 0;
+	int epochs = 0;
+	int option;
+
+	fleet_worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+	while((option = getopt(argc, argv, "n:w:e:t:s:")) != -1){
+		if(option == 'n'){
+			fleet_controller_count = atoi(optarg);
+		}
+		else if(option == 'w'){
+			fleet_worker_count = atoi(optarg);
+		}
+		else if(option == 'e'){
+			fleet_epoch_ms = atoi(optarg);
+		}
+		else if(option == 't'){
+			fleet_time_limit = strtod(optarg, NULL);
+		}
+		else if(option == 's'){
+			fleet_stagger = strtoul(optarg, NULL, 10);
+		}
+		else {
+			fprintf(stderr, "Usage: %s [-n controllers] [-w workers] [-e epoch ms] [-t seconds] [-s stagger us] [script]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(fleet_worker_count < 1){
+		fleet_worker_count = 1;
+	}
+	if(fleet_worker_count > FLEET_MAX_WORKERS){
+		fleet_worker_count = FLEET_MAX_WORKERS;
+	}
+	if((fleet_controller_count < 1) || (fleet_epoch_ms < 1)){
+		fprintf(stderr, "Need at least one controller and a 1ms epoch\n");
+		return EXIT_FAILURE;
+	}
+	if(optind < argc){
+		script = fopen(argv[optind], "r");
+		if(script == NULL){
+			perror(argv[optind]);
+			return EXIT_FAILURE;
+		}
+	}
+	sim_load_script(script);
+	if(!fleet_setup()){
+		return EXIT_FAILURE;
+	}
+
+	// The workers start with everything set up so far, and the shared memory
+	fflush(stdout);
+	for(int index = 0; index < fleet_worker_count; index++){
+		fleet_workers[index].process = fork();
+		if(fleet_workers[index].process == 0){
+			fleet_worker_main(&fleet_workers[index]);
+		}
+		if(fleet_workers[index].process < 0){
+			perror("Starting a worker");
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Run epochs until every controller has finished
+	epoch_cycles = (uint64_t)fleet_epoch_ms * TICKS_PER_MILLISECOND * SIM_CYCLES_PER_MICROSECOND;
+	host_start = fleet_host_now();
+	while(fleet_queue_epoch() > 0){
+		fleet_epochs->end += epoch_cycles;
+		epoch_start = fleet_host_now();
+		pthread_barrier_wait(&fleet_epochs->start);
+		pthread_barrier_wait(&fleet_epochs->finish);
+		epoch_length = fleet_host_now() - epoch_start;
+		epoch_time += epoch_length;
+		if(epoch_length > epoch_worst){
+			epoch_worst = epoch_length;
+		}
+		epochs++;
+	}
+	fleet_epochs->running = 0;
+	pthread_barrier_wait(&fleet_epochs->start);
+
+	for(int index = 0; index < fleet_worker_count; index++){
+		waitpid(fleet_workers[index].process, NULL, 0);
+	}
+	fleet_report(epochs, epoch_time, epoch_worst, fleet_host_now() - host_start);
+	return EXIT_SUCCESS;
+}
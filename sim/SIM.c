@@ -0,0 +1,1106 @@
+/*
+  The simulator file runs the whole controller on a Linux host, faster than real
+  time.  The program logic is built unchanged with HOST_BUILD defined, so the HAL
+  talks to the virtual peripherals in here instead of the board:
+
+    - TIM2 PWM output, every pulse width change is recorded (and printed with -v)
+    - the TIM2 update DMA burst, which plays a trajectory one frame every servo period
+    - the TIM5 timebase and its compare interrupt, which drives the timing wheel
+    - the DWT cycle counter
+    - USART2 under the UART.c driver, typed bytes arrive at 115200 baud from a script
+      and output leaves TDR for stdout one byte time after the other
+
+  The virtual clock only moves a cycle for every clock read while the program is
+  running.  Once the program sleeps the clock jumps straight to the next interrupt,
+  so a recipe that takes a minute on the board takes a few milliseconds here.  The
+  simulation ends once nothing is left to happen, or at the time limit.
+
+  The rest of the peripheral window is mapped as plain memory, so the init code in
+  the driver files writes its registers without anything listening.  The USART2
+  status register in there is kept up to date, so UART.c runs unchanged apart from
+  its TDR write, which comes here.  Only the clock setup, which waits on hardware
+  flags, is replaced in here.
+
+  Usage: servo_sim [-v] [-t seconds] [-b baud] [-p] [-w trace file] [script]
+         servo_sim -B [-u] [-l board console log] [baseline]
+
+  Every script line (or stdin line) is typed into the console followed by enter.
+  "@250" waits 250ms before the next line, "^C" sends the emergency stop byte and
+  lines starting with '#' are ignored.  -b sets the baud rate the bytes are typed at.
+
+  With -p there is no script.  USART2 becomes a pseudo terminal instead, whose name
+  is printed on start, and host tools open it just like the board's /dev/ttyACM0.
+  The virtual clock then keeps pace with the host clock, and bytes go each way no
+  faster than the -b baud rate would let them, so round trip times match the board.
+  Ctrl-C (SIGINT) ends the simulation with the usual report.
+
+  -B runs the benchmark suite (see BENCHMARK.c) on the host clock instead of the
+  program, and compares it with the baseline file given in place of the script.
+  Any case more than BENCHMARK_TOLERANCE percent slower fails the run, -u writes
+  the results as the new baseline instead.  With -l the results are not timed here
+  but read from a console capture of a board built with BENCHMARK_AT_BOOT, so the
+  DWT timings are compared with a baseline of the board's own the same way.
+
+  -w captures the waveform trace (see TRACE.c) from the start into a file of its
+  own, for trace_vcd to turn into a VCD.  The W command still turns it off and on
+
+  Built with FLEET_BUILD the same virtual peripherals back every controller of the
+  fleet simulator in FLEET.c instead, their state is INSTANCE like the firmware's
+  and each controller gets a peripheral window of its own
+*/
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SIM.h"
+#include "HAL.h"
+#include "UART.h"
+#include "SysClock.h"
+#include "SCHEDULER.h"
+#include "DELAY.h"
+#include "EMERGENCY_STOP.h"
+#include "TRACE.h"
+#include "BENCHMARK.h"
+
+// After the device header, its register names CR1 to CR3 are macros in here.  The PTY
+// setup never uses the CR1 delay flag, and the virtual USART2 needs its CR1 register back
+#include <termios.h>
+#undef CR1
+
+// The TIM5 compare handler in TIMING_WHEEL.c, the self test's in BENCHMARK.c and
+// the trajectory refill in TRAJECTORY.c
+void TIM5_IRQHandler(void);
+void TIM7_IRQHandler(void);
+void DMA1_Channel2_IRQHandler(void);
+
+// The core peripherals the host core header points at
+DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+SCB_Type sim_scb;
+uint32_t SystemCoreClock = SIM_CYCLES_PER_MICROSECOND * 1000000U;
+
+// The virtual clock, in core cycles since the controller started
+static INSTANCE uint64_t sim_cycles;
+static INSTANCE uint64_t sim_time_limit;
+static struct timespec sim_host_start;
+static int sim_verbose;
+
+// The interrupt state, PRIMASK and whether a handler is running right now
+static INSTANCE uint32_t sim_primask;
+static INSTANCE int sim_in_interrupt;
+
+// The virtual TIM5 compare channel
+static INSTANCE int sim_compare_armed;
+static INSTANCE uint32_t sim_compare_time;
+
+// The virtual trajectory DMA, the buffer it plays, the next frame and the cycle of the
+// TIM2 update event that plays it
+static INSTANCE uint32_t *sim_trajectory_buffer;
+static INSTANCE uint32_t sim_trajectory_words;
+static INSTANCE uint32_t sim_trajectory_next;
+static INSTANCE int sim_trajectory_running;
+static INSTANCE uint64_t sim_trajectory_update;
+
+// The script, one entry per byte with the cycle it arrives on.  Every controller
+// types the same script, starting at its own offset.  With a PTY the same entries
+// are a ring of the bytes the host sent that have not arrived yet
+static uint64_t sim_input_time[SIM_MAX_INPUT];
+static uint8_t sim_input_byte[SIM_MAX_INPUT];
+static int sim_input_count;
+static INSTANCE uint64_t sim_input_offset;
+static INSTANCE int sim_input_next;
+
+// How long one console byte takes on the wire
+static uint64_t sim_byte_cycles = (uint64_t)SIM_BITS_PER_BYTE * SIM_CYCLES_PER_MICROSECOND * 1000000U / SIM_DEFAULT_BAUD;
+
+// The PTY console, the master side and the bytes queued to go out on it, each with
+// the cycle its last bit leaves the virtual transmitter on
+static int sim_pty = -1;
+static uint8_t sim_tx_byte[SIM_TX_RING_SIZE];
+static uint64_t sim_tx_time[SIM_TX_RING_SIZE];
+static uint32_t sim_tx_read;
+static uint32_t sim_tx_write;
+static uint64_t sim_rx_last;
+static volatile sig_atomic_t sim_interrupted;
+
+// Where the waveform trace frames go, NULL sends them down the console like the board
+static FILE *sim_trace_file;
+
+// Set while the benchmark suite runs, the cycle counter counts host quarter nanoseconds
+// (the core clock is 4Ghz for the report) and the console output of the cases is dropped
+static int sim_benchmark;
+
+// Set once the benchmark report prints, nothing runs the virtual clock to pace it
+static int sim_console_direct;
+
+// The virtual USART2 transmitter, the byte waiting in TDR while TXE is clear and the
+// cycle the shift register finishes the byte on the wire
+static INSTANCE uint8_t sim_tx_data;
+static INSTANCE uint64_t sim_tx_idle;
+
+// The self test's software interrupt has been raised and not run yet
+static INSTANCE int sim_self_test_pending;
+
+// Stands in for SRAM2, it starts out zero like a power up
+static INSTANCE recipe_trace_buffer sim_retained_memory;
+
+// The part of the host stack the controller's stack measurements cover
+static INSTANCE uint32_t *sim_stack_top;
+static INSTANCE uint32_t *sim_stack_bottom;
+
+// The enter key the console has not answered with a prompt yet
+static INSTANCE int sim_line_waiting;
+static INSTANCE uint64_t sim_line_start;
+
+// What the virtual PWM outputs are doing, and everything else counted for the report
+static INSTANCE int sim_pwm_widths[NUMBER_OF_PWM_CHANNELS];
+static INSTANCE sim_statistics sim_stats;
+
+/*
+	Helper function that returns the virtual time on the TIM5 timebase
+
+	Output:
+		The number of microseconds since the simulation started, wrapping with 32 bits
+*/
+static uint32_t sim_microseconds(){
+	return (uint32_t)(sim_cycles / SIM_CYCLES_PER_MICROSECOND);
+}
+
+/*
+	This helper function prints what a virtual peripheral did, stamped with the
+	virtual time, when the simulator was started with -v
+
+	Input:
+		message - A printf style format string
+		...     - The values for the format string
+*/
+static void sim_trace(char *message, ...){
+	va_list data_points;
+
+	if(!sim_verbose){
+		return;
+	}
+	fprintf(stderr, "[%12.6f] ", (double)sim_cycles / (SIM_CYCLES_PER_MICROSECOND * 1000000.0));
+	va_start(data_points, message);
+	vfprintf(stderr, message, data_points);
+	va_end(data_points);
+	fputc('\n', stderr);
+}
+
+/*
+	This function ends the simulation and reports how far ahead of real time it ran.
+	In the fleet the controller hands its statistics over and stops instead
+*/
+static void sim_finish(){
+	struct timespec host_now;
+	double host_seconds;
+
+	sim_stats.cycles = sim_cycles;
+#ifdef FLEET_BUILD
+	fleet_controller_finished(&sim_stats);
+#endif
+	if(sim_trace_file != NULL){
+		trace_flush();
+		fclose(sim_trace_file);
+	}
+	fflush(stdout);
+	clock_gettime(CLOCK_MONOTONIC, &host_now);
+	host_seconds = (host_now.tv_sec - sim_host_start.tv_sec) + ((host_now.tv_nsec - sim_host_start.tv_nsec) / 1e9);
+	fprintf(stderr, "\nSimulated %.3f s of controller time in %.3f s, %lu servo pulse changes\n",
+		(double)sim_cycles / (SIM_CYCLES_PER_MICROSECOND * 1000000.0), host_seconds, sim_stats.pwm_changes);
+	if(sim_stats.commands > 0){
+		fprintf(stderr, "%lu command lines, %.1f us average and %.1f us worst from enter to the next prompt\n",
+			sim_stats.commands, (double)sim_stats.command_latency_total / sim_stats.commands / SIM_CYCLES_PER_MICROSECOND,
+			(double)sim_stats.command_latency_worst / SIM_CYCLES_PER_MICROSECOND);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+/*
+	Helper function to tell if the TIM5 compare has been reached
+
+	Output:
+		1 if the compare interrupt is armed and due, 0 otherwise
+*/
+static int sim_compare_pending(){
+	return sim_compare_armed && ((int32_t)(sim_microseconds() - sim_compare_time) >= 0);
+}
+
+/*
+	Helper function to tell if the next script byte has arrived
+
+	Output:
+		1 if a byte is waiting in the virtual USART2, 0 otherwise
+*/
+static int sim_rx_pending(){
+	return (sim_input_next < sim_input_count) && ((sim_input_time[sim_input_next % SIM_MAX_INPUT] + sim_input_offset) <= sim_cycles);
+}
+
+/*
+	Helper function to tell if a TIM2 update event has a trajectory frame to play
+
+	Output:
+		1 if the trajectory DMA is running and the update event is due, 0 otherwise
+*/
+static int sim_trajectory_pending(){
+	return sim_trajectory_running && (sim_trajectory_update <= sim_cycles);
+}
+
+/*
+	The virtual TIM2 update DMA burst.  It writes the next frame into the TIM2
+	channels and raises the DMA interrupt once it finishes either half of the buffer,
+	with the same DMA1 status flags the board's handler reads
+*/
+static void sim_trajectory_frame(){
+	uint32_t status = 0;
+
+	for(int channel = 0; channel < TRAJECTORY_FRAME_SIZE; channel++){
+		hal_host_pwm_write(channel, sim_trajectory_buffer[sim_trajectory_next + channel]);
+	}
+	sim_trajectory_next += TRAJECTORY_FRAME_SIZE;
+	sim_trajectory_update += SIM_UPDATE_CYCLES;
+	if(sim_trajectory_next == (sim_trajectory_words / 2)){
+		status = TRAJECTORY_DMA_HALF_TRANSFER;
+	}
+	else if(sim_trajectory_next >= sim_trajectory_words){
+		status = TRAJECTORY_DMA_TRANSFER_COMPLETE;
+		sim_trajectory_next = 0;
+	}
+	if(status != 0){
+		DMA_1_STATUS = status;
+		DMA1_Channel2_IRQHandler();
+		DMA_1_STATUS = 0;
+	}
+}
+
+/*
+	Helper function that reads the host clock
+
+	Output:
+		The number of host nanoseconds since the simulation started
+*/
+static uint64_t sim_host_nanoseconds(){
+	struct timespec host_now;
+
+	clock_gettime(CLOCK_MONOTONIC, &host_now);
+	return ((uint64_t)(host_now.tv_sec - sim_host_start.tv_sec) * 1000000000ULL) + host_now.tv_nsec - sim_host_start.tv_nsec;
+}
+
+/*
+	Helper function that reads the host clock on the virtual clock's scale
+
+	Output:
+		The number of cycles the virtual core would have run since the simulation started
+*/
+static uint64_t sim_host_cycles(){
+	return sim_host_nanoseconds() * SIM_CYCLES_PER_MICROSECOND / 1000;
+}
+
+/*
+	This helper function hands the PTY every queued byte the virtual transmitter
+	has finished sending by now
+*/
+static void sim_pty_transmit(){
+	uint64_t now = sim_host_cycles();
+
+	while((sim_tx_read != sim_tx_write) && (sim_tx_time[sim_tx_read % SIM_TX_RING_SIZE] <= now)){
+		if(write(sim_pty, &sim_tx_byte[sim_tx_read % SIM_TX_RING_SIZE], 1) != 1){
+			break;
+		}
+		sim_tx_read++;
+	}
+}
+
+/*
+	This helper function queues a byte for the PTY, to go once the virtual transmitter
+	has finished sending it
+
+	Input:
+		data - The byte
+		time - The cycle its stop bit goes out on
+*/
+static void sim_pty_queue(uint8_t data, uint64_t time){
+	// A host that stopped reading gets the oldest bytes early rather than losing any
+	if((sim_tx_write - sim_tx_read) == SIM_TX_RING_SIZE){
+		if(write(sim_pty, &sim_tx_byte[sim_tx_read % SIM_TX_RING_SIZE], 1) != 1){
+			return;
+		}
+		sim_tx_read++;
+	}
+	sim_tx_byte[sim_tx_write % SIM_TX_RING_SIZE] = data;
+	sim_tx_time[sim_tx_write % SIM_TX_RING_SIZE] = time;
+	sim_tx_write++;
+}
+
+/*
+	Helper function to tell if the byte in TDR has moved on to the shift register
+
+	Output:
+		1 if TDR holds a byte and the shift register is done with the one before
+*/
+static int sim_tx_shift_pending(){
+	return !(USART2->ISR & USART_ISR_TXE) && (sim_tx_idle <= sim_cycles);
+}
+
+/*
+	Helper function to tell if USART2 wants its interrupt, for a received byte or
+	for room in TDR while TXEIE is on
+
+	Output:
+		1 if the USART2 interrupt is due, 0 otherwise
+*/
+static int sim_usart_pending(){
+	return sim_rx_pending() || ((USART2->CR1 & USART_CR1_TXEIE) && (USART2->ISR & USART_ISR_TXE));
+}
+
+/*
+	This helper function puts a byte on the virtual wire, the moment it goes into the
+	shift register
+
+	Input:
+		data  - The byte
+		start - The cycle its start bit goes out on
+*/
+static void sim_tx_shift(uint8_t data, uint64_t start){
+	uint64_t latency;
+
+	sim_tx_idle = start + sim_byte_cycles;
+	sim_stats.bytes_out++;
+
+	// The prompt answers the last enter key
+	if(sim_line_waiting && (data == ASCII_TERMINAL_CHARACTER)){
+		latency = sim_cycles - sim_line_start;
+		sim_stats.commands++;
+		sim_stats.command_latency_total += latency;
+		if(latency > sim_stats.command_latency_worst){
+			sim_stats.command_latency_worst = latency;
+		}
+		sim_line_waiting = 0;
+	}
+	if(sim_pty >= 0){
+		sim_pty_queue(data, sim_tx_idle);
+		return;
+	}
+#ifndef FLEET_BUILD
+	putchar(data);
+#endif
+}
+
+/*
+	This helper function moves the byte waiting in TDR into the shift register once
+	the byte before it is out, which sets TXE again
+*/
+static void sim_tx_update(){
+	if(sim_tx_shift_pending()){
+		USART2->ISR |= USART_ISR_TXE;
+		sim_tx_shift(sim_tx_data, sim_tx_idle);
+	}
+}
+
+/*
+	The virtual USART2 interrupt.  A byte that has arrived goes into RDR with RXNE
+	set, and USART2_IRQHandler in UART.c does the rest, reading RDR clears RXNE
+*/
+static void sim_usart_interrupt(){
+	uint8_t data;
+
+	if(sim_rx_pending()){
+		data = sim_input_byte[sim_input_next % SIM_MAX_INPUT];
+		sim_input_next++;
+		if(data == ASCII_NEWLINE){
+			sim_line_waiting = 1;
+			sim_line_start = sim_cycles;
+		}
+		if(data == EMERGENCY_STOP_BYTE){
+			sim_trace("USART2 emergency stop byte");
+		}
+		USART2->RDR = data;
+		USART2->ISR |= USART_ISR_RXNE;
+	}
+	USART2_IRQHandler();
+	USART2->ISR &= ~USART_ISR_RXNE;
+}
+
+/*
+	This helper function runs every interrupt that is due, the same way the NVIC
+	would as soon as interrupts are enabled.  USART2 has the higher priority, and
+	handlers never nest
+*/
+static void sim_deliver_interrupts(){
+	sim_tx_update();
+	while((sim_primask == 0) && !sim_in_interrupt){
+		sim_in_interrupt = 1;
+		if(sim_usart_pending()){
+			sim_usart_interrupt();
+		}
+		else if(sim_trajectory_pending()){
+			sim_trajectory_frame();
+		}
+		else if(sim_compare_pending()){
+			TIM5_IRQHandler();
+		}
+		else if(sim_self_test_pending){
+			sim_self_test_pending = 0;
+			TIM7_IRQHandler();
+		}
+		else {
+			sim_in_interrupt = 0;
+			break;
+		}
+		sim_in_interrupt = 0;
+		sim_stats.interrupts++;
+	}
+}
+
+/*
+	This helper function charges a clock read to the virtual clock, so a loop
+	spinning on a clock still sees time go by, and lets any interrupt that came
+	due run
+*/
+static void sim_clock_read(){
+	sim_cycles += SIM_CYCLES_PER_READ;
+	sim_deliver_interrupts();
+}
+
+/*
+	Helper function to find the cycle the next interrupt comes due on
+
+	Output:
+		The virtual cycle of the next interrupt, SIM_NO_EVENT if nothing is coming
+*/
+static uint64_t sim_next_event(){
+	uint64_t next = SIM_NO_EVENT;
+	uint64_t compare;
+
+	if(sim_input_next < sim_input_count){
+		next = sim_input_time[sim_input_next % SIM_MAX_INPUT] + sim_input_offset;
+	}
+	if(sim_trajectory_running && (sim_trajectory_update < next)){
+		next = sim_trajectory_update;
+	}
+	if(!(USART2->ISR & USART_ISR_TXE) && (sim_tx_idle < next)){
+		next = sim_tx_idle;
+	}
+	if(sim_compare_armed){
+		compare = ((sim_cycles / SIM_CYCLES_PER_MICROSECOND) + (uint32_t)(sim_compare_time - sim_microseconds())) * SIM_CYCLES_PER_MICROSECOND;
+		if(compare < next){
+			next = compare;
+		}
+	}
+	return next;
+}
+
+/*
+	This helper function takes whatever the host wrote to the PTY and has each byte
+	arrive on the virtual USART2 one byte time after the one before
+*/
+static void sim_pty_receive(){
+	uint8_t data[BufferSize];
+	uint64_t arrival;
+	ssize_t length = read(sim_pty, data, sizeof(data));
+
+	for(ssize_t index = 0; index < length; index++){
+		if((sim_input_count - sim_input_next) >= SIM_MAX_INPUT){
+			sim_trace("USART2 overrun, %d bytes dropped", (int)(length - index));
+			return;
+		}
+		arrival = sim_rx_last + sim_byte_cycles;
+		if(arrival < sim_cycles){
+			arrival = sim_cycles;
+		}
+		sim_rx_last = arrival;
+		sim_input_time[sim_input_count % SIM_MAX_INPUT] = arrival;
+		sim_input_byte[sim_input_count % SIM_MAX_INPUT] = data[index];
+		sim_input_count++;
+	}
+}
+
+/*
+	The sleep of a simulator with a PTY console.  The host sleeps until the next
+	interrupt, the next output byte or input from the PTY, whichever is first, and
+	the virtual clock catches up with the host clock
+
+	Input:
+		next - The virtual cycle of the next interrupt, SIM_NO_EVENT if nothing is coming
+*/
+static void sim_pty_wait(uint64_t next){
+	struct pollfd console = {sim_pty, POLLIN, 0};
+	struct timespec timeout;
+	uint64_t now = sim_host_cycles();
+	uint64_t wake = next;
+
+	if(sim_interrupted || (now > sim_time_limit)){
+		sim_finish();
+	}
+	if((sim_tx_read != sim_tx_write) && (sim_tx_time[sim_tx_read % SIM_TX_RING_SIZE] < wake)){
+		wake = sim_tx_time[sim_tx_read % SIM_TX_RING_SIZE];
+	}
+	if(wake > sim_time_limit){
+		wake = sim_time_limit;
+	}
+	if(wake > now){
+		timeout.tv_sec = (wake - now) / (SIM_CYCLES_PER_MICROSECOND * 1000000ULL);
+		timeout.tv_nsec = ((wake - now) % (SIM_CYCLES_PER_MICROSECOND * 1000000ULL)) * 1000 / SIM_CYCLES_PER_MICROSECOND;
+		ppoll(&console, 1, &timeout, NULL);
+	}
+	else {
+		ppoll(&console, 1, &(struct timespec){0, 0}, NULL);
+	}
+
+	now = sim_host_cycles();
+	if(now > sim_cycles){
+		sim_cycles = now;
+	}
+	sim_pty_transmit();
+	if(console.revents & POLLIN){
+		sim_pty_receive();
+	}
+}
+
+/*
+	The sleep the program goes into when it has nothing to do.  Like __WFI it
+	returns straight away if an interrupt is already pending, otherwise the virtual
+	clock jumps to the next one.  With nothing left to happen the simulation is over.
+	With a PTY console the host sleeps in real time instead
+*/
+void sim_wait_for_interrupt(){
+	uint64_t next;
+
+	sim_tx_update();
+	if(sim_usart_pending() || sim_compare_pending() || sim_trajectory_pending()){
+		return;
+	}
+	next = sim_next_event();
+	if(sim_pty >= 0){
+		sim_pty_wait(next);
+		return;
+	}
+	if((next == SIM_NO_EVENT) || (next > sim_time_limit)){
+		sim_finish();
+	}
+#ifdef FLEET_BUILD
+	fleet_wait_for_epoch(next);
+#endif
+	sim_cycles = next;
+}
+
+void sim_irq_disable(){
+	sim_primask = 1;
+}
+
+void sim_irq_enable(){
+	sim_primask = 0;
+	sim_deliver_interrupts();
+}
+
+uint32_t sim_irq_mask(){
+	return sim_primask;
+}
+
+void sim_irq_set_mask(uint32_t mask){
+	sim_primask = mask;
+	sim_deliver_interrupts();
+}
+
+/*
+	The HAL host bindings, see HAL.h for what each one does on the board
+*/
+void hal_host_pwm_write(int channel, int pulse_width){
+	if((channel < 0) || (channel >= NUMBER_OF_PWM_CHANNELS)){
+		return;
+	}
+	if(sim_pwm_widths[channel] != pulse_width){
+		sim_stats.pwm_changes++;
+		sim_trace("PWM %d pulse width %d", channel, pulse_width);
+	}
+	sim_pwm_widths[channel] = pulse_width;
+}
+
+void hal_host_trajectory_start(uint32_t *buffer, uint32_t words){
+	sim_trajectory_buffer = buffer;
+	sim_trajectory_words = words;
+	sim_trajectory_next = 0;
+	sim_trajectory_update = ((sim_cycles / SIM_UPDATE_CYCLES) + 1) * SIM_UPDATE_CYCLES;
+	sim_trajectory_running = 1;
+	sim_trace("DMA1 channel 2 playing a trajectory");
+}
+
+void hal_host_trajectory_stop(){
+	if(sim_trajectory_running){
+		sim_trace("DMA1 channel 2 stopped");
+	}
+	sim_trajectory_running = 0;
+}
+
+uint32_t hal_host_timebase_now(){
+	sim_clock_read();
+	return sim_microseconds();
+}
+
+void hal_host_timebase_arm(uint32_t compare_time){
+	sim_compare_time = compare_time;
+	sim_compare_armed = 1;
+}
+
+void hal_host_timebase_disarm(){
+	sim_compare_armed = 0;
+}
+
+void hal_host_timebase_clear(){
+}
+
+uint32_t hal_host_cycles_now(){
+	if(sim_benchmark){
+		return (uint32_t)(sim_host_nanoseconds() * SIM_BENCHMARK_CYCLES_PER_NANOSECOND);
+	}
+	sim_clock_read();
+	return (uint32_t)sim_cycles;
+}
+
+void hal_host_usart_transmit(uint8_t data){
+	// The benchmark cases' output is dropped and their report goes straight out, TDR is
+	// always free for both
+	if(sim_benchmark){
+		return;
+	}
+	if(sim_console_direct){
+		putchar(data);
+		return;
+	}
+	sim_tx_update();
+	if(sim_tx_idle <= sim_cycles){
+		sim_tx_shift(data, sim_cycles);
+	}
+	else {
+		sim_tx_data = data;
+		USART2->ISR &= ~USART_ISR_TXE;
+	}
+}
+
+void hal_host_led_red(int on){
+	sim_trace("Red LED %s", on ? "on" : "off");
+}
+
+void hal_host_led_green(int on){
+	sim_trace("Green LED %s", on ? "on" : "off");
+}
+
+void hal_host_self_test_interrupt(){
+	sim_self_test_pending = 1;
+	sim_deliver_interrupts();
+}
+
+void *hal_host_retained_memory(){
+	return &sim_retained_memory;
+}
+
+uint32_t *hal_host_stack_bottom(){
+	return sim_stack_bottom;
+}
+
+uint32_t *hal_host_stack_top(){
+	return sim_stack_top;
+}
+
+uint32_t *hal_host_stack_pointer(){
+	return __builtin_frame_address(0);
+}
+
+void hal_host_trace_write(uint8_t *data, uint32_t length){
+	if(sim_trace_file != NULL){
+		fwrite(data, 1, length, sim_trace_file);
+	}
+	else {
+		USART_Write(USART2, data, length);
+	}
+}
+
+uint32_t hal_host_trace_room(){
+	if(sim_trace_file != NULL){
+		return UINT32_MAX;
+	}
+	return USART_Tx_Free(USART2);
+}
+
+/*
+	The clock setup waits on hardware flags, so it is replaced, there is nothing to set up
+*/
+void System_Clock_Init(){
+}
+
+/*
+	This helper function adds one byte to the script
+
+	Input:
+		time - The virtual cycle the byte arrives on
+		data - The byte
+*/
+static void sim_input_add(uint64_t time, uint8_t data){
+	if(sim_input_count >= SIM_MAX_INPUT){
+		fprintf(stderr, "Script is longer than %d bytes, the rest is ignored\n", SIM_MAX_INPUT);
+		return;
+	}
+	sim_input_time[sim_input_count] = time;
+	sim_input_byte[sim_input_count] = data;
+	sim_input_count++;
+}
+
+/*
+	This function turns a script into console bytes with the time each one arrives
+
+	Input:
+		script - The script to read
+*/
+void sim_load_script(FILE *script){
+	char line[SIM_MAX_INPUT];
+	uint64_t time = 0;
+	uint64_t byte_time = sim_byte_cycles;
+
+	while(fgets(line, sizeof(line), script) != NULL){
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if(line[0] == '#'){
+			continue;
+		}
+		if(line[0] == SIM_WAIT_PREFIX){
+			time += (uint64_t)strtoul(&line[1], NULL, 10) * TICKS_PER_MILLISECOND * SIM_CYCLES_PER_MICROSECOND;
+			continue;
+		}
+		if(strcmp(line, SIM_STOP_LINE) == 0){
+			time += byte_time;
+			sim_input_add(time, EMERGENCY_STOP_BYTE);
+			continue;
+		}
+		for(int index = 0; line[index] != '\0'; index++){
+			time += byte_time;
+			sim_input_add(time, (uint8_t)line[index]);
+		}
+		time += byte_time;
+		sim_input_add(time, ASCII_NEWLINE);
+	}
+}
+
+/*
+	This function maps the peripheral window as plain memory, so the driver init code
+	has somewhere to write its registers
+
+	Output:
+		SUCCESS if the window was mapped, FAILURE otherwise
+*/
+int sim_map_peripherals(){
+	if(mmap((void *)(uintptr_t)SIM_PERIPHERAL_BASE, SIM_PERIPHERAL_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0) == MAP_FAILED){
+		perror("Mapping the peripheral window");
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/*
+	This function gets the virtual peripherals of the calling thread's controller
+	ready to run
+
+	Input:
+		time_limit   - The virtual seconds the controller runs for at most
+		input_offset - The virtual microseconds to wait before typing the script
+*/
+void sim_controller_init(double time_limit, uint32_t input_offset){
+	sim_time_limit = (uint64_t)(time_limit * SIM_CYCLES_PER_MICROSECOND * 1000000.0);
+	sim_input_offset = (uint64_t)input_offset * SIM_CYCLES_PER_MICROSECOND;
+	clock_gettime(CLOCK_MONOTONIC, &sim_host_start);
+
+	// USART2 is enabled with nothing in flight, so USART_Init finds it ready
+	USART2->ISR = USART_ISR_TEACK | USART_ISR_REACK | USART_ISR_TXE | USART_ISR_TC;
+
+	// The firmware runs below the caller, paint SIM_STACK_SIZE of it like the startup code
+	// does, leaving this function's own frame alone
+	sim_stack_top = __builtin_frame_address(0);
+	sim_stack_bottom = sim_stack_top - (SIM_STACK_SIZE / sizeof(uint32_t));
+	for(uint32_t *word = sim_stack_bottom; word < sim_stack_top - SIM_STACK_FRAME_WORDS; word++){
+		*word = STACK_PAINT;
+	}
+}
+
+#ifndef FLEET_BUILD
+/*
+	This function runs the benchmark suite on the host clock SIM_BENCHMARK_RUNS times,
+	keeping the quickest average of every case, and prints the results
+
+	Input:
+		results - Filled in with what every case measured, MAX_BENCHMARKS long
+
+	Output:
+		The number of cases that ran
+*/
+static int sim_time_benchmarks(benchmark_result *results){
+	benchmark_result run[MAX_BENCHMARKS];
+	int count;
+
+	sim_benchmark = 1;
+	SystemCoreClock = SIM_BENCHMARK_CLOCK;
+	count = benchmark_run_all(results);
+	for(int again = 1; again < SIM_BENCHMARK_RUNS; again++){
+		benchmark_run_all(run);
+		for(int index = 0; index < count; index++){
+			if(run[index].cycles_per_operation < results[index].cycles_per_operation){
+				results[index].cycles_per_operation = run[index].cycles_per_operation;
+				results[index].operations_per_second = run[index].operations_per_second;
+			}
+			if(run[index].worst_cycles > results[index].worst_cycles){
+				results[index].worst_cycles = run[index].worst_cycles;
+			}
+		}
+	}
+	sim_benchmark = 0;
+	sim_console_direct = 1;
+	benchmark_print(results, count);
+	fflush(stdout);
+	return count;
+}
+
+/*
+	This function reads the results of a board's BENCHMARK_AT_BOOT run out of a
+	capture of its console, the lines benchmark_print wrote.  If the board was reset
+	more than once the last run counts
+
+	Input:
+		log     - The console capture
+		results - Filled in with what every case measured, MAX_BENCHMARKS long
+
+	Output:
+		The number of cases found, -1 if the capture could not be read
+*/
+static int sim_read_benchmark_log(char *log, benchmark_result *results){
+	static char names[MAX_BENCHMARKS][COMMAND_LINE_SIZE];
+	char line[OUTPUT_BUFFER_SIZE];
+	benchmark_result *result;
+	int count = 0;
+	FILE *file;
+
+	file = fopen(log, "r");
+	if(file == NULL){
+		perror(log);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), file) != NULL){
+		if(strncmp(line, "Benchmarks, ", strlen("Benchmarks, ")) == 0){
+			count = 0;
+			continue;
+		}
+		if(count == MAX_BENCHMARKS){
+			continue;
+		}
+		result = &results[count];
+		if(sscanf(line, "%63s %u cycles/op %u ops/s %u worst", names[count], &result->cycles_per_operation,
+			&result->operations_per_second, &result->worst_cycles) == 4){
+			result->name = names[count];
+			count++;
+		}
+	}
+	fclose(file);
+	fprintf(stderr, "%d benchmark cases in %s\n", count, log);
+	return count;
+}
+
+/*
+	This function checks benchmark results against a baseline file of "name cycles"
+	lines, or writes a new one
+
+	Input:
+		results  - What every case measured
+		count    - The number of cases
+		baseline - The baseline file, NULL to only print the results
+		update   - 1 to write the results to the baseline file instead
+
+	Output:
+		EXIT_SUCCESS if no case got slower than the tolerance, EXIT_FAILURE otherwise
+*/
+static int sim_check_benchmarks(benchmark_result *results, int count, char *baseline, int update){
+	char name[COMMAND_LINE_SIZE];
+	unsigned long cycles;
+	int regressions = 0;
+	FILE *file;
+
+	if(baseline == NULL){
+		return EXIT_SUCCESS;
+	}
+
+	if(update){
+		file = fopen(baseline, "w");
+		if(file == NULL){
+			perror(baseline);
+			return EXIT_FAILURE;
+		}
+		for(int index = 0; index < count; index++){
+			fprintf(file, "%s %u\n", results[index].name, results[index].cycles_per_operation);
+		}
+		fclose(file);
+		fprintf(stderr, "Baseline written to %s\n", baseline);
+		return EXIT_SUCCESS;
+	}
+
+	file = fopen(baseline, "r");
+	if(file == NULL){
+		perror(baseline);
+		return EXIT_FAILURE;
+	}
+	while(fscanf(file, "%63s %lu", name, &cycles) == 2){
+		for(int index = 0; index < count; index++){
+			if(strcmp(name, results[index].name) != 0){
+				continue;
+			}
+			if((uint64_t)results[index].cycles_per_operation * 100 > (uint64_t)cycles * (100 + BENCHMARK_TOLERANCE)){
+				fprintf(stderr, "REGRESSION %s: %u cycles/op, baseline %lu\n", name, results[index].cycles_per_operation, cycles);
+				regressions++;
+			}
+			else {
+				fprintf(stderr, "ok %s: %u cycles/op, baseline %lu\n", name, results[index].cycles_per_operation, cycles);
+			}
+		}
+	}
+	fclose(file);
+	return (regressions == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+	The SIGINT handler of a simulator with a PTY console, the simulation ends at the
+	next sleep
+
+	Input:
+		signal_number - Not used
+*/
+static void sim_interrupt(int signal_number){
+	sim_interrupted = 1;
+}
+
+/*
+	This function opens the pseudo terminal that stands in for USART2 and prints
+	its name for the host tools
+
+	Output:
+		SUCCESS if the PTY is ready, FAILURE otherwise
+*/
+static int sim_pty_open(){
+	struct termios settings;
+	char *name;
+
+	sim_pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if((sim_pty < 0) || (grantpt(sim_pty) != 0) || (unlockpt(sim_pty) != 0)){
+		perror("Opening the PTY");
+		return FAILURE;
+	}
+	name = ptsname(sim_pty);
+
+	// Raw bytes both ways, like the USB serial port of the board
+	tcgetattr(sim_pty, &settings);
+	cfmakeraw(&settings);
+	tcsetattr(sim_pty, TCSANOW, &settings);
+	fcntl(sim_pty, F_SETFL, fcntl(sim_pty, F_GETFL) | O_NONBLOCK);
+
+	// Holding the terminal side open keeps the PTY up while host tools come and go
+	if(open(name, O_RDWR | O_NOCTTY) < 0){
+		perror(name);
+		return FAILURE;
+	}
+	fprintf(stderr, "Console on %s\n", name);
+	signal(SIGINT, sim_interrupt);
+	return SUCCESS;
+}
+
+int main(int argc, char *argv[]){
+	double time_limit = SIM_DEFAULT_TIME_LIMIT;
+	FILE *script = stdin;
+	int use_pty = 0;
+	int benchmark = 0;
+	int update = 0;
+	char *benchmark_log = NULL;
+	benchmark_result results[MAX_BENCHMARKS];
+	int count;
+	long baud;
+	int option;
+
+	while((option = getopt(argc, argv, "vt:b:pw:Bul:")) != -1){
+		if(option == 'v'){
+			sim_verbose = 1;
+		}
+		else if(option == 't'){
+			time_limit = strtod(optarg, NULL);
+		}
+		else if((option == 'b') && ((baud = strtol(optarg, NULL, 10)) > 0)){
+			sim_byte_cycles = (uint64_t)SIM_BITS_PER_BYTE * SIM_CYCLES_PER_MICROSECOND * 1000000U / baud;
+		}
+		else if(option == 'p'){
+			use_pty = 1;
+		}
+		else if(option == 'B'){
+			benchmark = 1;
+		}
+		else if(option == 'u'){
+			update = 1;
+		}
+		else if(option == 'l'){
+			benchmark_log = optarg;
+		}
+		else if(option == 'w'){
+			sim_trace_file = fopen(optarg, "wb");
+			if(sim_trace_file == NULL){
+				perror(optarg);
+				return EXIT_FAILURE;
+			}
+		}
+		else {
+			fprintf(stderr, "Usage: %s [-v] [-t seconds] [-b baud] [-p] [-w trace file] [script]\n", argv[0]);
+			fprintf(stderr, "       %s -B [-u] [-l board console log] [baseline]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(benchmark && (benchmark_log != NULL)){
+		count = sim_read_benchmark_log(benchmark_log, results);
+		if(count <= 0){
+			return EXIT_FAILURE;
+		}
+		return sim_check_benchmarks(results, count, (optind < argc) ? argv[optind] : NULL, update);
+	}
+	if(benchmark){
+		if(!sim_map_peripherals()){
+			return EXIT_FAILURE;
+		}
+		sim_controller_init(time_limit, 0);
+		count = sim_time_benchmarks(results);
+		return sim_check_benchmarks(results, count, (optind < argc) ? argv[optind] : NULL, update);
+	}
+	if(use_pty){
+		if(!sim_pty_open()){
+			return EXIT_FAILURE;
+		}
+	}
+	else if(optind < argc){
+		script = fopen(argv[optind], "r");
+		if(script == NULL){
+			perror(argv[optind]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(!use_pty){
+		sim_load_script(script);
+	}
+	if(!sim_map_peripherals()){
+		return EXIT_FAILURE;
+	}
+
+	sim_controller_init(time_limit, 0);
+	if(sim_trace_file != NULL){
+		trace_enable(TRACE_ON);
+	}
+	firmware_main();
+	sim_finish();
+	return EXIT_SUCCESS;
+}
+#endif
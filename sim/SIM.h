@@ -0,0 +1,130 @@
+/*
+  Function declarations for the virtual peripherals, shared by the single controller
+  simulator and the fleet simulator
+*/
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <ucontext.h>
+
+// Defines for the simulator.  The virtual clock counts core cycles, and only
+// moves on its own while the core sleeps, when it jumps straight to the next interrupt
+#define SIM_CYCLES_PER_MICROSECOND (DELAY_DEFAULT_CYCLES_PER_MICROSECOND) // The virtual core runs at 80Mhz
+#define SIM_CYCLES_PER_READ (1)                          // Reading a clock costs a cycle, so spin waits on a clock still end
+#define SIM_DEFAULT_BAUD (115200)                        // Console baud rate when -b is not given
+#define SIM_BITS_PER_BYTE (10)                           // Start bit, 8 data bits and a stop bit on the wire
+#define SIM_TX_RING_SIZE (65536)                         // Console bytes the PTY transmitter can have queued
+#define SIM_DEFAULT_TIME_LIMIT (86400)                   // Seconds of virtual time before the simulation gives up
+#define SIM_MAX_INPUT (65536)                            // The most console bytes one script can type, or the PTY can have waiting
+#define SIM_PERIPHERAL_BASE (PERIPH_BASE)                // Start of the peripheral window mapped as plain memory
+#define SIM_PERIPHERAL_SIZE (0x10100000)                 // Covers APB1 through the end of AHB2
+#define SIM_WAIT_PREFIX ('@')                            // A script line "@250" waits 250ms before the next line
+#define SIM_STOP_LINE ("^C")                             // A script line "^C" sends the emergency stop byte
+#define SIM_NO_EVENT (0xFFFFFFFFFFFFFFFFULL)             // No interrupt is coming
+#define SIM_BENCHMARK_CLOCK (4000000000U)                // The benchmarks count host quarter nanoseconds as cycles, about a host core's clock
+#define SIM_BENCHMARK_CYCLES_PER_NANOSECOND (4)          // So the quickest cases still come out at more than a few cycles
+#define SIM_BENCHMARK_RUNS (20)                          // The suite runs this often and every case keeps its quickest, a busy host only slows runs
+#define SIM_STACK_SIZE (32 * 1024)                       // The host stack below the controller's start that is painted and measured
+#define SIM_STACK_FRAME_WORDS (64)                       // Left unpainted under the painter, it is still using them
+#define SIM_UPDATE_CYCLES (TRAJECTORY_FRAME_TIME * TICKS_PER_MILLISECOND * SIM_CYCLES_PER_MICROSECOND) // Cycles between TIM2 update events, each plays a trajectory frame
+
+// Defines for the fleet simulator, many simulated controllers stepped in lockstep epochs
+// of virtual time over a pool of worker processes
+#define FLEET_DEFAULT_CONTROLLERS (1000)                 // Controllers simulated when -n is not given
+#define FLEET_DEFAULT_EPOCH (100)                        // Milliseconds of virtual time every controller runs per epoch
+#define FLEET_MAX_WORKERS (256)                          // The most worker processes, -w defaults to one per core
+#define FLEET_STACK_SIZE (256 * 1024)                    // The stack of each controller's coroutine, only what it touches is ever backed
+#define FLEET_NO_CONTROLLER (-1)                         // Nothing left to take from the work queues
+
+// What the simulator counted while one controller ran, for the reports
+typedef struct{
+	uint64_t cycles;									// Virtual core cycles the controller ran for
+	unsigned long pwm_changes;				// Servo pulse width changes
+	unsigned long bytes_out;					// Console bytes written
+	unsigned long interrupts;					// Interrupts delivered
+	unsigned long commands;						// Command lines that got a prompt back
+	uint64_t command_latency_total;		// Cycles from each enter key to the next prompt, added up
+	uint64_t command_latency_worst;		// The longest of those
+} sim_statistics;
+
+// One simulated controller of the fleet, a coroutine any worker can resume.  Its firmware
+// state (everything declared INSTANCE) waits in its own image while it is not running
+typedef struct{
+	ucontext_t context;								// Where the controller carries on when a worker resumes it
+	uint8_t *state;										// The controller's copy of the INSTANCE section
+	int index;												// The controller number, which staggers its script and picks its peripherals
+	int finished;											// Set once the controller has nothing left to do
+	sim_statistics statistics;				// Filled in when the controller finishes
+} fleet_controller;
+
+// One worker of the pool and its queue of controllers still to run this epoch.  The
+// worker takes from the back of its own queue and steals from the front of others
+typedef struct{
+	pid_t process;
+	pthread_mutex_t lock;							// Shared by every worker process
+	int *controllers;									// The queue, room for every controller
+	int head;													// The next controller a thief takes
+	int tail;													// One past the next controller the owner takes
+	unsigned long runs;								// Controller epochs this worker ran
+	unsigned long steals;							// How many of those it stole
+} fleet_worker;
+
+// The lockstep epochs, shared by the main process and every worker
+typedef struct{
+	pthread_barrier_t start;					// Everyone meets here before an epoch
+	pthread_barrier_t finish;					// and here once every controller has run up to its end
+	uint64_t end;											// The virtual cycle the epoch ends on
+	int running;											// Cleared once every controller has finished
+} fleet_epoch;
+
+/*
+	The firmware's main, renamed when main.c is built for the host
+*/
+int firmware_main(void);
+
+/*
+	This function turns a script into console bytes with the time each one arrives
+
+	Input:
+		script - The script to read
+*/
+void sim_load_script(FILE *script);
+
+/*
+	This function maps the peripheral window as plain memory, so the driver init code
+	has somewhere to write its registers
+
+	Output:
+		SUCCESS if the window was mapped, FAILURE otherwise
+*/
+int sim_map_peripherals(void);
+
+/*
+	This function gets the virtual peripherals of the running controller ready to run
+
+	Input:
+		time_limit   - The virtual seconds the controller runs for at most
+		input_offset - The virtual microseconds to wait before typing the script
+*/
+void sim_controller_init(double time_limit, uint32_t input_offset);
+
+/*
+	This function holds a sleeping controller back until the fleet reaches the epoch
+	its next interrupt falls in.  It is in FLEET.c
+
+	Input:
+		cycle - The virtual cycle the controller wants to wake up on
+*/
+void fleet_wait_for_epoch(uint64_t cycle);
+
+/*
+	This function takes a finished controller's statistics and hands its worker back,
+	it never returns.  It is in FLEET.c
+
+	Input:
+		statistics - What the simulator counted while the controller ran
+*/
+void fleet_controller_finished(sim_statistics *statistics);
@@ -0,0 +1,179 @@
+/*
+  The trace converter turns waveform trace frames (see TRACE.c) into a VCD file that
+  any waveform viewer can open.  It takes either the file servo_sim -w wrote or a raw
+  capture of the board's console, the frames are picked out by TRACE_SYNC and the
+  console text around them is skipped.
+
+  Usage: trace_vcd [trace file] > trace.vcd
+
+  Every servo is a 16 bit signal holding its pulse width, every LED a 1 bit signal,
+  and "lost" counts the records the board had to drop.  Time is in microseconds on
+  the controller's timebase
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stm32l476xx.h"
+#include "CONSTANTS.h"
+
+// The VCD signal identifiers, one printable character per signal
+#define VCD_FIRST_IDENTIFIER ('!')
+#define VCD_LED_IDENTIFIER(led) (VCD_FIRST_IDENTIFIER + NUMBER_OF_PWM_CHANNELS + (led))
+#define VCD_LOST_IDENTIFIER (VCD_LED_IDENTIFIER(NUMBER_OF_TRACE_LEDS))
+#define VCD_VALUE_BITS (16)
+
+// The controller time of the last record, unwrapped to 64 bits
+static uint64_t vcd_time;
+static uint32_t vcd_last_raw_time;
+static int vcd_have_time;
+static uint64_t vcd_printed_time;
+static unsigned long vcd_lost;
+
+/*
+	Helper function that reads a little endian number out of a frame
+
+	Input:
+		data  - The first byte of the number
+		bytes - How many bytes it has
+
+	Output:
+		The number
+*/
+static uint32_t vcd_little_endian(uint8_t *data, int bytes){
+	uint32_t value = 0;
+
+	for(int index = bytes - 1; index >= 0; index--){
+		value = (value << 8) | data[index];
+	}
+	return value;
+}
+
+/*
+	This function prints the VCD header with every signal
+*/
+static void vcd_header(){
+	printf("$version servo controller waveform trace $end\n");
+	printf("$timescale 1us $end\n");
+	printf("$scope module controller $end\n");
+	for(int channel = 0; channel < NUMBER_OF_PWM_CHANNELS; channel++){
+		printf("$var wire %d %c servo_%d $end\n", VCD_VALUE_BITS, VCD_FIRST_IDENTIFIER + channel, channel);
+	}
+	printf("$var wire 1 %c led_red $end\n", VCD_LED_IDENTIFIER(TRACE_LED_RED));
+	printf("$var wire 1 %c led_green $end\n", VCD_LED_IDENTIFIER(TRACE_LED_GREEN));
+	printf("$var integer 32 %c lost $end\n", VCD_LOST_IDENTIFIER);
+	printf("$upscope $end\n");
+	printf("$enddefinitions $end\n");
+}
+
+/*
+	This helper function prints a value in the binary form VCD wants for vectors
+
+	Input:
+		value      - The value
+		identifier - The signal it belongs to
+*/
+static void vcd_vector(uint32_t value, char identifier){
+	char bits[33];
+	int length = 0;
+
+	do {
+		bits[length] = '0' + (value & 1);
+		length++;
+		value >>= 1;
+	} while(value != 0);
+	putchar('b');
+	while(length > 0){
+		length--;
+		putchar(bits[length]);
+	}
+	printf(" %c\n", identifier);
+}
+
+/*
+	This function prints one trace record as a VCD value change
+
+	Input:
+		record - The TRACE_RECORD_SIZE bytes of the record
+*/
+static void vcd_record(uint8_t *record){
+	uint32_t raw_time = vcd_little_endian(&record[0], 4);
+	int kind = record[4];
+	int channel = record[5];
+	uint32_t value = vcd_little_endian(&record[6], 2);
+
+	// The timebase wraps every 71 minutes, the records are in order so only forward counts
+	if(vcd_have_time){
+		vcd_time += (uint32_t)(raw_time - vcd_last_raw_time);
+	}
+	else {
+		vcd_time = raw_time;
+	}
+	vcd_last_raw_time = raw_time;
+	if(!vcd_have_time || (vcd_time != vcd_printed_time)){
+		printf("#%llu\n", (unsigned long long)vcd_time);
+		vcd_printed_time = vcd_time;
+		vcd_have_time = 1;
+	}
+
+	if((kind == TRACE_KIND_PWM) && (channel < NUMBER_OF_PWM_CHANNELS)){
+		vcd_vector(value, VCD_FIRST_IDENTIFIER + channel);
+	}
+	else if((kind == TRACE_KIND_LED) && (channel < NUMBER_OF_TRACE_LEDS)){
+		printf("%d%c\n", value ? 1 : 0, VCD_LED_IDENTIFIER(channel));
+	}
+	else if(kind == TRACE_KIND_LOST){
+		vcd_lost += value;
+		vcd_vector(vcd_lost, VCD_LOST_IDENTIFIER);
+	}
+}
+
+int main(int argc, char *argv[]){
+	FILE *trace = stdin;
+	uint8_t sync[TRACE_SYNC_SIZE] = {0};
+	uint8_t count_bytes[TRACE_FRAME_HEADER_SIZE - TRACE_SYNC_SIZE];
+	uint8_t record[TRACE_RECORD_SIZE];
+	unsigned long frames = 0;
+	unsigned long records = 0;
+	uint32_t count;
+	int data;
+
+	if(argc > 2){
+		fprintf(stderr, "Usage: %s [trace file] > trace.vcd\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(argc == 2){
+		trace = fopen(argv[1], "rb");
+		if(trace == NULL){
+			perror(argv[1]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	vcd_header();
+	while((data = fgetc(trace)) != EOF){
+
+		// Slide the last few bytes along until they are TRACE_SYNC
+		memmove(sync, &sync[1], TRACE_SYNC_SIZE - 1);
+		sync[TRACE_SYNC_SIZE - 1] = data;
+		if(memcmp(sync, TRACE_SYNC, TRACE_SYNC_SIZE) != 0){
+			continue;
+		}
+		memset(sync, 0xFF, TRACE_SYNC_SIZE);
+		if(fread(count_bytes, 1, sizeof(count_bytes), trace) != sizeof(count_bytes)){
+			break;
+		}
+		count = vcd_little_endian(count_bytes, sizeof(count_bytes));
+		for(uint32_t index = 0; index < count; index++){
+			if(fread(record, 1, TRACE_RECORD_SIZE, trace) != TRACE_RECORD_SIZE){
+				break;
+			}
+			vcd_record(record);
+			records++;
+		}
+		frames++;
+	}
+	fprintf(stderr, "%lu records in %lu frames, %lu lost on the controller\n", records, frames, vcd_lost);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+/*
+  Host stand in for the CMSIS Cortex-M4 core header.  The core peripherals the
+  program uses (DWT, CoreDebug, SCB) are plain structs, and the interrupt masking,
+  sleep and NVIC calls go to the simulator so it can deliver interrupts and move
+  the virtual clock
+*/
+#ifndef _SIM_CORE_CM4_
+#define _SIM_CORE_CM4_
+
+#include <stdint.h>
+
+#define __IO volatile
+#define __I volatile const
+#define __O volatile
+#define __IM volatile const
+#define __OM volatile
+#define __IOM volatile
+#define __ASM __asm
+#define __INLINE inline
+#define __STATIC_INLINE static inline
+
+// The core peripherals, only the registers the program touches
+typedef struct{
+	__IO uint32_t CTRL;
+	__IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct{
+	__IO uint32_t DHCSR;
+	__IO uint32_t DCRSR;
+	__IO uint32_t DCRDR;
+	__IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct{
+	__I uint32_t CPUID;
+	__IO uint32_t ICSR;
+	__IO uint32_t VTOR;
+	__IO uint32_t AIRCR;
+	__IO uint32_t SCR;
+	__IO uint32_t CCR;
+} SCB_Type;
+
+extern DWT_Type sim_dwt;
+extern CoreDebug_Type sim_core_debug;
+extern SCB_Type sim_scb;
+
+#define DWT (&sim_dwt)
+#define CoreDebug (&sim_core_debug)
+#define SCB (&sim_scb)
+
+#define DWT_CTRL_CYCCNTENA_Msk (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define SCB_SCR_SLEEPDEEP_Msk (1UL << 2)
+
+// The simulator side of the core, in SIM.c
+void sim_irq_disable(void);
+void sim_irq_enable(void);
+uint32_t sim_irq_mask(void);
+void sim_irq_set_mask(uint32_t mask);
+void sim_wait_for_interrupt(void);
+
+__STATIC_INLINE void __disable_irq(void){
+	sim_irq_disable();
+}
+
+__STATIC_INLINE void __enable_irq(void){
+	sim_irq_enable();
+}
+
+__STATIC_INLINE uint32_t __get_PRIMASK(void){
+	return sim_irq_mask();
+}
+
+__STATIC_INLINE void __set_PRIMASK(uint32_t mask){
+	sim_irq_set_mask(mask);
+}
+
+__STATIC_INLINE void __WFI(void){
+	sim_wait_for_interrupt();
+}
+
+__STATIC_INLINE void __DSB(void){
+}
+
+__STATIC_INLINE void __ISB(void){
+}
+
+__STATIC_INLINE void __NOP(void){
+}
+
+__STATIC_INLINE uint32_t __CLZ(uint32_t value){
+	return (value == 0) ? 32 : __builtin_clz(value);
+}
+
+__STATIC_INLINE uint32_t __RBIT(uint32_t value){
+	uint32_t reversed = 0;
+
+	for(int bit = 0; bit < 32; bit++){
+		reversed = (reversed << 1) | (value & 1);
+		value >>= 1;
+	}
+	return reversed;
+}
+
+// The simulator delivers interrupts itself, so the NVIC setup has nothing to do
+__STATIC_INLINE void NVIC_EnableIRQ(IRQn_Type irq){
+	(void)irq;
+}
+
+__STATIC_INLINE void NVIC_DisableIRQ(IRQn_Type irq){
+	(void)irq;
+}
+
+__STATIC_INLINE void NVIC_SetPriority(IRQn_Type irq, uint32_t priority){
+	(void)irq;
+	(void)priority;
+}
+
+__STATIC_INLINE void NVIC_ClearPendingIRQ(IRQn_Type irq){
+	(void)irq;
+}
+
+#endif
@@ -0,0 +1,11 @@
+/*
+  Host stand in for the CMSIS system header
+*/
+#ifndef _SIM_SYSTEM_STM32L4XX_
+#define _SIM_SYSTEM_STM32L4XX_
+
+#include <stdint.h>
+
+extern uint32_t SystemCoreClock;
+
+#endif
@@ -105,9 +105,10 @@
 ;******************** END ************************************************************************
 
 
-Stack_Size      EQU     0x400;
+Stack_Size      EQU     0x1000;                     ; Over the high water mark servo_sim measures, cut it once M has been read on a board
 
                 AREA    STACK, NOINIT, READWRITE, ALIGN=3
+                EXPORT  Stack_Mem                   ; STACK.c measures the high water mark from here
 Stack_Mem       SPACE   Stack_Size
 __initial_sp
 
@@ -268,6 +269,14 @@ Initialize_ZI	 CMP	r3,	r1
 				 STRCC r2, [r3], #4
 				 BCC	Initialize_ZI
 
+				 ; Paint the stack, nothing is on it yet.  The value is STACK_PAINT in CONSTANTS.h
+				 LDR	r0,	=Stack_Mem
+				 MOV	r1,	sp
+				 LDR	r2,	=0xC5C5C5C5
+Paint_Stack		 CMP	r0,	r1
+				 STRCC r2, [r0], #4
+				 BCC	Paint_Stack
+
 				 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 				 ; Enable FPU
 				 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;